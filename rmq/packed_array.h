@@ -0,0 +1,194 @@
+#ifndef _PACKED_ARRAY_H_
+#define _PACKED_ARRAY_H_
+
+// Read-only array of integers stored with a fixed number of bits per element.
+// Values are stored relative to the smallest one (frame of reference), so
+// e.g. numbers in [1000, 3000) take 11 bits each. Elements may straddle two
+// 64-bit words. It can be used as the input of the RMQ classes in rmq.h in
+// place of a std::vector, but only NaiveRMQ, BlockRMQ and
+// CompressedSparseTableRMQ keep the memory savings: they read A in place,
+// while SparseTableRMQ and RangeMinMax unpack it into their first level.
+
+#include <vector>
+#include <algorithm>
+#include <type_traits>
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+
+template<class T>
+class PackedArray
+{
+    private:
+        // One extra word at the end, so that reading the word after the one
+        // holding an element is always valid (also with 0 bits per element,
+        // where every element is in word 0).
+        std::vector<uint64_t> words;
+        size_t n;
+        unsigned bits;
+        uint64_t mask;
+        T base;
+
+        // Bits [shift, shift+bits) of the 128-bit value hi:lo. Shifting hi
+        // in two steps avoids an undefined shift by 64 when shift is 0.
+        uint64_t extract(uint64_t lo, uint64_t hi, unsigned shift) const
+        {
+            return ((lo >> shift) | ((hi << 1) << (63 - shift))) & this->mask;
+        };
+
+        void unpack_scalar(size_t from, size_t count, T *out) const
+        {
+            for(size_t i = 0; i < count; ++i)
+                out[i] = (*this)[from + i];
+        };
+
+    public:
+        // Packs values using as few bits as the range of values allows.
+        PackedArray(const std::vector<T> &values) :
+            n(values.size()), bits(0), mask(0), base(0)
+        {
+            // Here rather than at class scope: the read_input and input_min
+            // overloads for PackedArray<T> instantiate the class for any T.
+            static_assert(std::is_integral<T>::value,
+                          "PackedArray only stores integers");
+
+            if(this->n > 0)
+            {
+                T min = values[0], max = values[0];
+                for(size_t i = 1; i < this->n; ++i)
+                {
+                    min = values[i] < min ? values[i] : min;
+                    max = max < values[i] ? values[i] : max;
+                }
+                uint64_t range = (uint64_t)max - (uint64_t)min;
+                this->base = min;
+                this->bits = range == 0 ? 0 : 64 - __builtin_clzll(range);
+                this->mask = this->bits == 64 ? ~(uint64_t)0 :
+                             ((uint64_t)1 << this->bits) - 1;
+            }
+
+            this->words.resize(std::max((this->n * this->bits + 63) / 64,
+                                        (size_t)1) + 1);
+            for(size_t i = 0; i < this->n; ++i)
+            {
+                uint64_t value = (uint64_t)values[i] - (uint64_t)this->base;
+                size_t bit = i * this->bits, word = bit / 64;
+                unsigned shift = bit % 64;
+                this->words[word] |= value << shift;
+                if(shift + this->bits > 64)
+                    this->words[word+1] |= value >> (64 - shift);
+            }
+        };
+
+        size_t size() const
+        {
+            return this->n;
+        };
+
+        unsigned width() const
+        {
+            return this->bits;
+        };
+
+        // Bytes used by the packed elements.
+        size_t memory() const
+        {
+            return this->words.size() * sizeof(uint64_t);
+        };
+
+        T operator[](size_t i) const
+        {
+            assert(i < this->n);
+
+            size_t bit = i * this->bits, word = bit / 64;
+            return (T)((uint64_t)this->base +
+                       this->extract(this->words[word], this->words[word+1],
+                                     bit % 64));
+        };
+
+        // Decodes elements [from, from+count) into out. With AVX2/AVX-512,
+        // 4/8 elements are decoded at once: the two words holding each of
+        // them are gathered and shifted into place lane by lane.
+        void unpack(size_t from, size_t count, T *out) const
+        {
+            assert(from + count <= this->n);
+            size_t i = 0;
+
+#if defined(__AVX512F__)
+            const uint64_t b = this->bits;
+            const __m512i lane_bits = _mm512_set_epi64(7*b, 6*b, 5*b, 4*b,
+                                                       3*b, 2*b, b, 0),
+                          mask = _mm512_set1_epi64(this->mask),
+                          base = _mm512_set1_epi64((uint64_t)this->base),
+                          ones = _mm512_set1_epi64(1),
+                          sixty_three = _mm512_set1_epi64(63);
+            for(; i + 8 <= count; i += 8)
+            {
+                __m512i bit = _mm512_add_epi64(
+                                  _mm512_set1_epi64((from + i) * this->bits),
+                                  lane_bits),
+                        word = _mm512_srli_epi64(bit, 6),
+                        shift = _mm512_and_si512(bit, sixty_three),
+                        lo = _mm512_i64gather_epi64(word, this->words.data(), 8),
+                        hi = _mm512_i64gather_epi64(_mm512_add_epi64(word, ones),
+                                                    this->words.data(), 8),
+                        value = _mm512_or_si512(
+                                    _mm512_srlv_epi64(lo, shift),
+                                    _mm512_sllv_epi64(_mm512_slli_epi64(hi, 1),
+                                        _mm512_sub_epi64(sixty_three, shift)));
+                value = _mm512_add_epi64(_mm512_and_si512(value, mask), base);
+
+                if(sizeof(T) == 8)
+                    _mm512_storeu_si512((void*)(out + i), value);
+                else if(sizeof(T) == 4)
+                    _mm256_storeu_si256((__m256i*)(out + i),
+                                        _mm512_cvtepi64_epi32(value));
+                else
+                {
+                    uint64_t lanes[8];
+                    _mm512_storeu_si512((void*)lanes, value);
+                    for(size_t k = 0; k < 8; ++k)
+                        out[i+k] = (T)lanes[k];
+                }
+            }
+#elif defined(__AVX2__)
+            const uint64_t b = this->bits;
+            const __m256i lane_bits = _mm256_set_epi64x(3*b, 2*b, b, 0),
+                          mask = _mm256_set1_epi64x(this->mask),
+                          base = _mm256_set1_epi64x((uint64_t)this->base),
+                          ones = _mm256_set1_epi64x(1),
+                          sixty_three = _mm256_set1_epi64x(63);
+            const long long *words = (const long long*)this->words.data();
+            for(; i + 4 <= count; i += 4)
+            {
+                __m256i bit = _mm256_add_epi64(
+                                  _mm256_set1_epi64x((from + i) * this->bits),
+                                  lane_bits),
+                        word = _mm256_srli_epi64(bit, 6),
+                        shift = _mm256_and_si256(bit, sixty_three),
+                        lo = _mm256_i64gather_epi64(words, word, 8),
+                        hi = _mm256_i64gather_epi64(words,
+                                 _mm256_add_epi64(word, ones), 8),
+                        value = _mm256_or_si256(
+                                    _mm256_srlv_epi64(lo, shift),
+                                    _mm256_sllv_epi64(_mm256_slli_epi64(hi, 1),
+                                        _mm256_sub_epi64(sixty_three, shift)));
+                value = _mm256_add_epi64(_mm256_and_si256(value, mask), base);
+
+                uint64_t lanes[4];
+                _mm256_storeu_si256((__m256i*)lanes, value);
+                for(size_t k = 0; k < 4; ++k)
+                    out[i+k] = (T)lanes[k];
+            }
+#endif
+
+            this->unpack_scalar(from + i, count - i, out + i);
+        };
+};
+
+#endif
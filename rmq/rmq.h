@@ -6,49 +6,217 @@
 #include <assert.h>
 #include <algorithm>
 #include <math.h>
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <tuple>
+#include <utility>
+#include "rmq_simd.h"
+#include "packed_array.h"
 
+#define log_interval(i,j) (floor_log2((j)-(i)+1))
 
+// Returned by the threshold searches when no element qualifies.
+#define RMQ_NOT_FOUND ((size_t)-1)
+
+
+// floor(log2(x)) for x > 0, computed with a single bit-scan instruction
+// instead of a lookup table.
+inline size_t floor_log2(size_t x)
+{
+    assert(x > 0);
+    return 8*sizeof(unsigned long long) - 1 - __builtin_clzll(x);
+}
+
+
+// Reading the input of an RMQ. Generic containers are read element by
+// element; vectors and packed arrays have overloads that read whole runs at
+// once (SIMD min over contiguous memory, SIMD unpacking of packed words).
+
+// Copies A[from..from+count) to out.
+template<class T, class Input>
+void read_input(const Input &A, size_t from, size_t count, T *out)
+{
+    for(size_t i = 0; i < count; ++i)
+        out[i] = A[from + i];
+}
+
+template<class T>
+void read_input(const std::vector<T> &A, size_t from, size_t count, T *out)
+{
+    std::copy(A.begin() + from, A.begin() + from + count, out);
+}
+
+template<class T>
+void read_input(const PackedArray<T> &A, size_t from, size_t count, T *out)
+{
+    A.unpack(from, count, out);
+}
+
+// Minimum of A[from..to].
+template<class T, class Input>
+T input_min(const Input &A, size_t from, size_t to)
+{
+    T min = A[from];
+    for(size_t k = from+1; k <= to; ++k)
+        min = std::min(min, (T)A[k]);
+    return min;
+}
+
+template<class T>
+T input_min(const std::vector<T> &A, size_t from, size_t to)
+{
+    return min_reduce(&A[from], to - from + 1);
+}
+
+template<class T>
+T input_min(const PackedArray<T> &A, size_t from, size_t to)
+{
+    // Decode one chunk at a time into a buffer that stays in L1.
+    T buffer[256], min = A[from];
+    for(size_t chunk = from; chunk <= to; chunk += 256)
+    {
+        size_t count = std::min(to - chunk + 1, (size_t)256);
+        A.unpack(chunk, count, buffer);
+        min = std::min(min, min_reduce(buffer, count));
+    }
+    return min;
+}
+
+
+// Binary lifting over the levels of a sparse table: block_min(k, p) has to
+// return the minimum of A[p..p+2^k-1]. Since the minimum of a prefix of
+// [i, j] can only decrease as the prefix grows, the longest prefix whose
+// elements are all >= x can be found greedily from the highest level down,
+// looking at each level once. The first position past that prefix is the
+// answer.
+template<class T, class F>
+size_t first_less_descent(size_t i, size_t j, const T &x, F block_min)
+{
+    size_t position = i;
+    for(size_t k = log_interval(i, j) + 1; k-- > 0; )
+        if(position + ((size_t)1 << k) - 1 <= j &&
+           !(block_min(k, position) < x))
+            position += (size_t)1 << k;
+
+    return position <= j ? position : RMQ_NOT_FOUND;
+}
+
+// Mirror image of first_less_descent, growing a suffix of [i, j] instead.
+template<class T, class F>
+size_t last_less_descent(size_t i, size_t j, const T &x, F block_min)
+{
+    size_t end = j + 1;
+    for(size_t k = log_interval(i, j) + 1; k-- > 0; )
+        if(end >= i + ((size_t)1 << k) &&
+           !(block_min(k, end - ((size_t)1 << k)) < x))
+            end -= (size_t)1 << k;
+
+    return end > i ? end - 1 : RMQ_NOT_FOUND;
+}
+
+
+// Query (i, j, x) for the batched threshold searches.
 template<class T>
+using ThresholdQuery = std::tuple<size_t, size_t, T>;
+
+
+template<class T, class Input = std::vector<T> >
 class RMQ
 {
+    // The input can be a std::vector<T> or any other container with size()
+    // and an operator[] returning T, such as PackedArray<T>.
+
     protected:
-        const std::vector<T> &A;
+        const Input &A;
         size_t n;
 
+        // Threshold searches. These defaults just scan the range; structures
+        // that can do better override them.
+        virtual size_t first_less(size_t i, size_t j, const T &x) const
+        {
+            for(size_t k = i; k <= j; ++k)
+                if(this->A[k] < x)
+                    return k;
+            return RMQ_NOT_FOUND;
+        };
+
+        virtual size_t last_less(size_t i, size_t j, const T &x) const
+        {
+            for(size_t k = j+1; k-- > i; )
+                if(this->A[k] < x)
+                    return k;
+            return RMQ_NOT_FOUND;
+        };
+
     public:
-        RMQ(const std::vector<T> &A) : A(A), n(A.size()) {};
+        RMQ(const Input &A) : A(A), n(A.size()) {};
 
         virtual T operator()(size_t, size_t) const = 0;
+
+        // First (resp. last) position k in [i, j] such that A[k] < x, or
+        // RMQ_NOT_FOUND if there is none.
+        size_t find_first_less(size_t i, size_t j, const T &x) const
+        {
+            assert(i <= j && j < this->n);
+            return this->first_less(i, j, x);
+        };
+
+        size_t find_last_less(size_t i, size_t j, const T &x) const
+        {
+            assert(i <= j && j < this->n);
+            return this->last_less(i, j, x);
+        };
+
+        // Batched versions: one answer per query, in the same order.
+        std::vector<size_t> find_first_less(
+            const std::vector<ThresholdQuery<T> > &queries) const
+        {
+            std::vector<size_t> answers(queries.size());
+            for(size_t q = 0; q < queries.size(); ++q)
+                answers[q] = this->find_first_less(std::get<0>(queries[q]),
+                                                   std::get<1>(queries[q]),
+                                                   std::get<2>(queries[q]));
+            return answers;
+        };
+
+        std::vector<size_t> find_last_less(
+            const std::vector<ThresholdQuery<T> > &queries) const
+        {
+            std::vector<size_t> answers(queries.size());
+            for(size_t q = 0; q < queries.size(); ++q)
+                answers[q] = this->find_last_less(std::get<0>(queries[q]),
+                                                  std::get<1>(queries[q]),
+                                                  std::get<2>(queries[q]));
+            return answers;
+        };
 };
 
 
-template<class T>
-class NaiveRMQ : public RMQ<T>
+template<class T, class Input = std::vector<T> >
+class NaiveRMQ : public RMQ<T, Input>
 {
     public:
-        NaiveRMQ(const std::vector<T> &A) : RMQ<T>(A) {};
+        NaiveRMQ(const Input &A) : RMQ<T, Input>(A) {};
 
         virtual T operator()(size_t i, size_t j) const
         {
             assert(i <= j && j < this->n);
             
-            T min = this->A[i];
-            for(size_t k = i+1; k <= j; ++k)
-                min = std::min(min, this->A[k]);
-
-            return min; 
+            return input_min<T>(this->A, i, j);
         };
 };
 
 
-template<class T>
-class FullyPrecomputedRMQ : public RMQ<T>
+template<class T, class Input = std::vector<T> >
+class FullyPrecomputedRMQ : public RMQ<T, Input>
 {
     private:
         std::vector<std::vector<T> > mins;
 
     public:
-        FullyPrecomputedRMQ(const std::vector<T> &A) : RMQ<T>(A)
+        FullyPrecomputedRMQ(const Input &A) : RMQ<T, Input>(A)
         {
             this->mins.resize(this->n);
             for(size_t i = 0; i < this->n; ++i)
@@ -72,34 +240,31 @@ class FullyPrecomputedRMQ : public RMQ<T>
 };
 
 
-template<class T>
-class BlockRMQ : public RMQ<T>
+template<class T, class Input = std::vector<T> >
+class BlockRMQ : public RMQ<T, Input>
 {
-    #define BLOCK_SIZE   (size_t)floor(sqrt(this->n))
-    #define NUM_BLOCKS   ceil(this->n / (double)BLOCK_SIZE)
-    #define idx(i,j)     (i*BLOCK_SIZE + j)
-    #define block_idx(i) (i / BLOCK_SIZE)
-    #define offset(i)    (i % BLOCK_SIZE)
+    #define block_idx(i)   ((i) / this->block_size)
+    #define block_start(i) ((i) * this->block_size)
 
     private:
         std::vector<T> block_mins;
         size_t block_size;
 
-        T min_on_block(size_t i, size_t from=0, ssize_t to=-1) const
+        // Minimum of A[from..to] (both ends inclusive).
+        T min_on_range(size_t from, size_t to) const
         {
-            T current_min = this->A[idx(i,from)];
-            to = to >= 0 ? to : this->block_size;
-            for(size_t j = from+1; j < to; ++j)
-                current_min = std::min(current_min, this->A[idx(i,j)]);
-            return current_min;
+            return input_min<T>(this->A, from, to);
         };
 
     public:
-        BlockRMQ(const std::vector<T> &A) : RMQ<T>(A), block_size(BLOCK_SIZE)
+        BlockRMQ(const Input &A) : RMQ<T, Input>(A),
+            block_size(std::max((size_t)floor(sqrt((double)A.size())), (size_t)1))
         {
-            this->block_mins.resize(NUM_BLOCKS);
-            for(size_t i = 0; i < NUM_BLOCKS; ++i)
-                this->block_mins[i] = this->min_on_block(i);
+            size_t num_blocks = (this->n + this->block_size - 1) / this->block_size;
+            this->block_mins.resize(num_blocks);
+            for(size_t i = 0; i < num_blocks; ++i)
+                this->block_mins[i] = this->min_on_range(
+                    block_start(i), std::min(block_start(i+1), this->n) - 1);
         };
 
         virtual T operator()(size_t i, size_t j) const
@@ -109,8 +274,11 @@ class BlockRMQ : public RMQ<T>
             size_t i_block = block_idx(i),
                    j_block = block_idx(j);
 
-            T left_block_min = this->min_on_block(i_block, offset(i), this->block_size),
-              right_block_min = this->min_on_block(j_block, 0, offset(j)),
+            if(i_block == j_block)
+                return this->min_on_range(i, j);
+
+            T left_block_min = this->min_on_range(i, block_start(i_block+1) - 1),
+              right_block_min = this->min_on_range(block_start(j_block), j),
               current_min = std::min(left_block_min, right_block_min);
             
             for(size_t k = i_block+1; k < j_block; ++k)
@@ -121,56 +289,1066 @@ class BlockRMQ : public RMQ<T>
 };
 
 
-template<class T>
-class SparseTableRMQ : public RMQ<T>
+template<class T, class Input = std::vector<T> >
+class SparseTableRMQ : public RMQ<T, Input>
 {
-    #define log_interval(i,j) (this->logs[j-i+1])
-    
     private:
+        // mins[k][i] holds the minimum of A[i..i+2^k-1]. Each level is kept
+        // as a contiguous row, so level k is just two shifted copies of level
+        // k-1 min-ed together (see min_streams in rmq_simd.h).
         std::vector<std::vector<T> > mins;
-        std::vector<int> logs;
 
-        void compute_logs()
+    protected:
+        virtual size_t first_less(size_t i, size_t j, const T &x) const
+        {
+            return first_less_descent(i, j, x,
+                [this](size_t k, size_t p) { return this->mins[k][p]; });
+        };
+
+        virtual size_t last_less(size_t i, size_t j, const T &x) const
         {
-            this->logs.resize(this->n+2);
-            int current_log = -1, current_pow = 1;
-            for(size_t i = 1; i <= 1+this->n; ++i)
+            return last_less_descent(i, j, x,
+                [this](size_t k, size_t p) { return this->mins[k][p]; });
+        };
+
+    public:
+        SparseTableRMQ(const Input &A) : RMQ<T, Input>(A)
+        {
+            if(this->n == 0)
+                return;
+
+            this->mins.resize(floor_log2(this->n) + 1);
+            this->mins[0].resize(this->n);
+            read_input(this->A, 0, this->n, &this->mins[0][0]);
+
+            for(size_t j = 1; j < this->mins.size(); ++j)
             {
-                if(i == current_pow)
-                {
-                    current_log++;
-                    current_pow <<= 1;
-                }
-                this->logs[i] = current_log;
+                size_t length = this->n - ((size_t)1 << j) + 1;
+                this->mins[j].resize(length);
+                min_streams(&this->mins[j-1][0],
+                            &this->mins[j-1][(size_t)1 << (j-1)],
+                            &this->mins[j][0],
+                            length);
             }
         };
-        
-    public:
-        SparseTableRMQ(const std::vector<T> &A) : RMQ<T>(A)
+
+        virtual T operator()(size_t i, size_t j) const
         {
-            this->mins.resize(this->n);
-            this->compute_logs();
+            assert(i <= j && j < this->n);
             
+            size_t k = log_interval(i, j);
+            return std::min(this->mins[k][i],
+                            this->mins[k][j - ((size_t)1 << k) + 1]);
+        };
+};
+
+template<class T, class Input = std::vector<T> >
+class CompressedSparseTableRMQ : public RMQ<T, Input>
+{
+    // Sparse table that stores, for each level k and position i, the offset
+    // of the leftmost minimum of A[i..i+2^k-1] relative to i. Such an offset
+    // lies in [0, 2^k), so levels 1-8 use one byte per entry, levels 9-16 use
+    // two bytes, levels 17-32 four bytes and the rest (only present for more
+    // than 2^32 elements) eight bytes. Level 0 is implicit (offset 0).
+    // Queries compare the two candidate positions directly on A.
+
+    private:
+        // offsetsW[k] holds level k if W is the narrowest width that fits it,
+        // and is empty otherwise.
+        std::vector<std::vector<uint8_t> > offsets8;
+        std::vector<std::vector<uint16_t> > offsets16;
+        std::vector<std::vector<uint32_t> > offsets32;
+        std::vector<std::vector<uint64_t> > offsets64;
+        template<class O, class P>
+        void build_level(std::vector<O> &level, const std::vector<P> &previous,
+                         size_t k)
+        {
+            size_t half = (size_t)1 << (k-1),
+                   length = this->n - ((size_t)1 << k) + 1;
+            level.resize(length);
+            for(size_t i = 0; i < length; ++i)
+            {
+                size_t left = k > 1 ? previous[i] : 0,
+                       right = half + (k > 1 ? previous[i + half] : 0);
+                level[i] = this->A[i + right] < this->A[i + left] ? right : left;
+            }
+        };
+
+        size_t level_offset(size_t k, size_t i) const
+        {
+            if(k == 0)
+                return 0;
+            if(k <= 8)
+                return this->offsets8[k][i];
+            if(k <= 16)
+                return this->offsets16[k][i];
+            if(k <= 32)
+                return this->offsets32[k][i];
+            return this->offsets64[k][i];
+        };
+
+    protected:
+        virtual size_t first_less(size_t i, size_t j, const T &x) const
+        {
+            return first_less_descent(i, j, x,
+                [this](size_t k, size_t p)
+                { return this->A[p + this->level_offset(k, p)]; });
+        };
+
+        virtual size_t last_less(size_t i, size_t j, const T &x) const
+        {
+            return last_less_descent(i, j, x,
+                [this](size_t k, size_t p)
+                { return this->A[p + this->level_offset(k, p)]; });
+        };
+
+    public:
+        CompressedSparseTableRMQ(const Input &A) : RMQ<T, Input>(A)
+        {
+            size_t num_levels = this->n > 0 ? floor_log2(this->n) + 1 : 0;
+
+            this->offsets8.resize(std::min(num_levels, (size_t)9));
+            this->offsets16.resize(std::min(num_levels, (size_t)17));
+            this->offsets32.resize(std::min(num_levels, (size_t)33));
+            this->offsets64.resize(num_levels);
+
+            for(size_t k = 1; k < num_levels; ++k)
+            {
+                if(k <= 8)
+                    this->build_level(this->offsets8[k], this->offsets8[k-1], k);
+                else if(k == 9)
+                    this->build_level(this->offsets16[k], this->offsets8[k-1], k);
+                else if(k <= 16)
+                    this->build_level(this->offsets16[k], this->offsets16[k-1], k);
+                else if(k == 17)
+                    this->build_level(this->offsets32[k], this->offsets16[k-1], k);
+                else if(k <= 32)
+                    this->build_level(this->offsets32[k], this->offsets32[k-1], k);
+                else if(k == 33)
+                    this->build_level(this->offsets64[k], this->offsets32[k-1], k);
+                else
+                    this->build_level(this->offsets64[k], this->offsets64[k-1], k);
+            }
+        };
+
+        // Position of the leftmost minimum of A[i..j].
+        size_t argmin(size_t i, size_t j) const
+        {
+            assert(i <= j && j < this->n);
+
+            size_t k = log_interval(i, j),
+                   left = i + this->level_offset(k, i),
+                   right = j - ((size_t)1 << k) + 1;
+            right += this->level_offset(k, right);
+            return this->A[right] < this->A[left] ? right : left;
+        };
+
+        virtual T operator()(size_t i, size_t j) const
+        {
+            return this->A[this->argmin(i, j)];
+        };
+};
+
+template<class T, class Input = std::vector<T> >
+class RangeMinMax : public RMQ<T, Input>
+{
+    // Sparse table answering both the minimum and the maximum of a range.
+    // Each level stores interleaved (min, max) pairs, so that a query reads
+    // both values from the same cache line at each of its two positions, and
+    // every level is built with a single pass over the previous one.
+
+    private:
+        // levels[k][2*i] and levels[k][2*i+1] hold the minimum and maximum
+        // of A[i..i+2^k-1].
+        std::vector<std::vector<T> > levels;
+
+        const T *pair_at(size_t k, size_t i) const
+        {
+            return &this->levels[k][2*i];
+        };
+
+    protected:
+        virtual size_t first_less(size_t i, size_t j, const T &x) const
+        {
+            return first_less_descent(i, j, x,
+                [this](size_t k, size_t p) { return *this->pair_at(k, p); });
+        };
+
+        virtual size_t last_less(size_t i, size_t j, const T &x) const
+        {
+            return last_less_descent(i, j, x,
+                [this](size_t k, size_t p) { return *this->pair_at(k, p); });
+        };
+
+    public:
+        RangeMinMax(const Input &A) : RMQ<T, Input>(A)
+        {
+            if(this->n == 0)
+                return;
+
+            this->levels.resize(floor_log2(this->n) + 1);
+            std::vector<T> values(this->n);
+            read_input(this->A, 0, this->n, &values[0]);
+            this->levels[0].resize(2*this->n);
             for(size_t i = 0; i < this->n; ++i)
+                this->levels[0][2*i] = this->levels[0][2*i+1] = values[i];
+
+            for(size_t k = 1; k < this->levels.size(); ++k)
             {
-                this->mins[i].resize(log_interval(i, this->n));
-                this->mins[i][0] = this->A[i];
+                size_t length = this->n - ((size_t)1 << k) + 1;
+                this->levels[k].resize(2*length);
+                minmax_streams(this->pair_at(k-1, 0),
+                               this->pair_at(k-1, (size_t)1 << (k-1)),
+                               &this->levels[k][0],
+                               2*length);
             }
+        };
+
+        std::pair<T, T> min_max(size_t i, size_t j) const
+        {
+            assert(i <= j && j < this->n);
 
-            for(size_t j = 1; (1 << j) < this->n; ++j)
-                for(size_t i = 0; (i + (1 << j) - 1) < this->n; ++i)
-                    this->mins[i][j] = std::min(this->mins[i][j-1],
-                                                this->mins[i + (1 << (j-1))][j-1]);
+            size_t k = log_interval(i, j);
+            const T *left = this->pair_at(k, i),
+                    *right = this->pair_at(k, j - ((size_t)1 << k) + 1);
+            return std::make_pair(std::min(left[0], right[0]),
+                                  std::max(left[1], right[1]));
+        };
+
+        T max(size_t i, size_t j) const
+        {
+            return this->min_max(i, j).second;
+        };
+
+        virtual T operator()(size_t i, size_t j) const
+        {
+            return this->min_max(i, j).first;
+        };
+};
+
+template<class T, class R = CompressedSparseTableRMQ<T> >
+class RangeTopK
+{
+    // k smallest elements of a range, built on top of an RMQ answering
+    // argmin queries. The minimum m of [i, j] is the first answer; the next
+    // one is the minimum of either [i, m-1] or [m+1, j], and so on. Keeping the
+    // candidate subranges in a heap keyed by their minimum gives O(k log k)
+    // per query regardless of the length of the range.
+
+    private:
+        // Candidate subrange [lo, hi] whose minimum is at pos.
+        struct Candidate
+        {
+            size_t pos, lo, hi;
+        };
+
+        const std::vector<T> &A;
+        R rmq;
+
+        // Orders the heap so that its top is the candidate with the smallest
+        // value, breaking ties by position.
+        bool greater(const Candidate &a, const Candidate &b) const
+        {
+            if(this->A[a.pos] == this->A[b.pos])
+                return a.pos > b.pos;
+            return this->A[b.pos] < this->A[a.pos];
+        };
+
+        // std::push_heap needs a copyable comparison object.
+        struct Comparator
+        {
+            const RangeTopK *top_k;
+            bool operator()(const Candidate &a, const Candidate &b) const
+            {
+                return top_k->greater(a, b);
+            };
+        };
+
+        Comparator comparator() const
+        {
+            Comparator c = {this};
+            return c;
+        };
+
+        void push(std::vector<Candidate> &heap, size_t lo, size_t hi) const
+        {
+            Candidate candidate = {this->rmq.argmin(lo, hi), lo, hi};
+            heap.push_back(candidate);
+            std::push_heap(heap.begin(), heap.end(), this->comparator());
+        };
+
+        // Appends to out the positions of the k smallest elements of A[i..j],
+        // sorted by value. heap is scratch space reused between calls.
+        void positions(size_t i, size_t j, size_t k, std::vector<size_t> &out,
+                       std::vector<Candidate> &heap) const
+        {
+            assert(i <= j && j < this->A.size());
+
+            heap.clear();
+            this->push(heap, i, j);
+            while(k-- > 0 && !heap.empty())
+            {
+                std::pop_heap(heap.begin(), heap.end(), this->comparator());
+                Candidate c = heap.back();
+                heap.pop_back();
+                out.push_back(c.pos);
+
+                if(c.pos > c.lo)
+                    this->push(heap, c.lo, c.pos - 1);
+                if(c.pos < c.hi)
+                    this->push(heap, c.pos + 1, c.hi);
+            }
+        };
+
+    public:
+        RangeTopK(const std::vector<T> &A) : A(A), rmq(A) {};
+
+        // Positions of the k smallest elements of A[i..j] (all of them if the
+        // range is shorter), in ascending order of value.
+        std::vector<size_t> positions(size_t i, size_t j, size_t k) const
+        {
+            // k may be much larger than the range.
+            size_t count = std::min(k, j - i + 1);
+            std::vector<size_t> out;
+            std::vector<Candidate> heap;
+            out.reserve(count);
+            heap.reserve(count+1);
+            this->positions(i, j, k, out, heap);
+            return out;
+        };
+
+        // The k smallest elements of A[i..j] in ascending order.
+        std::vector<T> operator()(size_t i, size_t j, size_t k) const
+        {
+            std::vector<size_t> positions = this->positions(i, j, k);
+            std::vector<T> values(positions.size());
+            for(size_t p = 0; p < positions.size(); ++p)
+                values[p] = this->A[positions[p]];
+            return values;
+        };
+
+        // Batched version: answers every range in ranges with the same k,
+        // sharing the scratch heap between queries.
+        std::vector<std::vector<T> > operator()(
+            const std::vector<std::pair<size_t, size_t> > &ranges,
+            size_t k) const
+        {
+            std::vector<std::vector<T> > results(ranges.size());
+            size_t count = std::min(k, this->A.size());
+            std::vector<size_t> positions;
+            std::vector<Candidate> heap;
+            positions.reserve(count);
+            heap.reserve(count+1);
+
+            for(size_t q = 0; q < ranges.size(); ++q)
+            {
+                positions.clear();
+                this->positions(ranges[q].first, ranges[q].second, k,
+                                positions, heap);
+                results[q].resize(positions.size());
+                for(size_t p = 0; p < positions.size(); ++p)
+                    results[q][p] = this->A[positions[p]];
+            }
+            return results;
+        };
+};
+
+template<class T>
+class LazySparseTableRMQ : public RMQ<T>
+{
+    // Sparse table whose levels are built on first use, so that short-range
+    // queries only pay for the low levels. Level 0 is A itself. Materializing
+    // is serialized by a mutex, while queries on levels that are already
+    // built only do an atomic load.
+
+    private:
+        // mins[k][i] is the minimum of A[i..i+2^k-1] for 0 < k < ready. The
+        // outer vector is sized up front and never reallocated, so readers
+        // can use a built level while another one is being materialized.
+        mutable std::vector<std::vector<T> > mins;
+        mutable std::atomic<size_t> ready;
+        mutable std::mutex materialize_lock;
+
+        void materialize(size_t k) const
+        {
+            std::lock_guard<std::mutex> guard(this->materialize_lock);
+
+            for(size_t j = this->ready.load(std::memory_order_relaxed); j <= k; ++j)
+            {
+                const std::vector<T> &previous = j == 1 ? this->A : this->mins[j-1];
+                size_t length = this->n - ((size_t)1 << j) + 1;
+                this->mins[j].resize(length);
+                min_streams(&previous[0],
+                            &previous[(size_t)1 << (j-1)],
+                            &this->mins[j][0],
+                            length);
+                this->ready.store(j+1, std::memory_order_release);
+            }
+        };
+
+        const std::vector<T> &level(size_t k) const
+        {
+            if(k == 0)
+                return this->A;
+            if(k >= this->ready.load(std::memory_order_acquire))
+                this->materialize(k);
+            return this->mins[k];
+        };
+
+    protected:
+        virtual size_t first_less(size_t i, size_t j, const T &x) const
+        {
+            return first_less_descent(i, j, x,
+                [this](size_t k, size_t p) { return this->level(k)[p]; });
+        };
+
+        virtual size_t last_less(size_t i, size_t j, const T &x) const
+        {
+            return last_less_descent(i, j, x,
+                [this](size_t k, size_t p) { return this->level(k)[p]; });
+        };
+
+    public:
+        LazySparseTableRMQ(const std::vector<T> &A) : RMQ<T>(A), ready(1)
+        {
+            if(this->n > 0)
+                this->mins.resize(floor_log2(this->n) + 1);
+        };
+
+        // Number of levels materialized so far (level 0 included).
+        size_t levels_built() const
+        {
+            return this->ready.load(std::memory_order_acquire);
         };
 
         virtual T operator()(size_t i, size_t j) const
         {
             assert(i <= j && j < this->n);
-            
+
             size_t k = log_interval(i, j);
-            return std::min(this->mins[i][k],
-                            this->mins[j - (1 << k) + 1][k]);
+            const std::vector<T> &mins = this->level(k);
+            return std::min(mins[i], mins[j - ((size_t)1 << k) + 1]);
         };
 };
 
+
+template<class T>
+class MultiColumnRMQ
+{
+    // Sparse table over several columns of the same length, for answering the
+    // same range on all of them at once. Within each level the values of all
+    // columns at a given position are stored next to each other, so a query
+    // reads two contiguous runs of `width` values and mins them with a single
+    // min_streams pass, and each level is built with one min_streams call.
+
+    private:
+        size_t n, width;
+        // levels[k][i*width + c] holds the minimum of column c over
+        // [i, i+2^k-1].
+        std::vector<std::vector<T> > levels;
+
+    public:
+        MultiColumnRMQ(const std::vector<std::vector<T> > &columns) :
+            n(columns.empty() ? 0 : columns[0].size()), width(columns.size())
+        {
+            if(this->n == 0)
+                return;
+
+            this->levels.resize(floor_log2(this->n) + 1);
+            this->levels[0].resize(this->n * this->width);
+            for(size_t c = 0; c < this->width; ++c)
+            {
+                assert(columns[c].size() == this->n);
+                for(size_t i = 0; i < this->n; ++i)
+                    this->levels[0][i*this->width + c] = columns[c][i];
+            }
+
+            for(size_t k = 1; k < this->levels.size(); ++k)
+            {
+                size_t length = this->n - ((size_t)1 << k) + 1;
+                this->levels[k].resize(length * this->width);
+                min_streams(&this->levels[k-1][0],
+                            &this->levels[k-1][((size_t)1 << (k-1)) * this->width],
+                            &this->levels[k][0],
+                            length * this->width);
+            }
+        };
+
+        size_t columns() const
+        {
+            return this->width;
+        };
+
+        // Writes the minimum of every column over [i, j] to out[0..columns()).
+        void operator()(size_t i, size_t j, T *out) const
+        {
+            assert(i <= j && j < this->n);
+
+            size_t k = log_interval(i, j);
+            min_streams(&this->levels[k][i * this->width],
+                        &this->levels[k][(j - ((size_t)1 << k) + 1) * this->width],
+                        out,
+                        this->width);
+        };
+
+        std::vector<T> operator()(size_t i, size_t j) const
+        {
+            std::vector<T> mins(this->width);
+            (*this)(i, j, &mins[0]);
+            return mins;
+        };
+};
+
+
+template<class T>
+class PersistentRMQ : public RMQ<T>
+{
+    // Fully persistent segment tree. An update never modifies existing nodes:
+    // it copies the O(log n) nodes on the path from the root to the updated
+    // leaf and returns a handle to the new version, so every version stays
+    // queryable and they all share the nodes they have in common.
+    // operator() answers on the initial version, i.e., on A itself.
+
+    public:
+        typedef size_t Version;
+
+    private:
+        struct Node
+        {
+            T min;
+            size_t left, right;
+        };
+
+        // All nodes of all versions; children are referenced by index.
+        std::vector<Node> nodes;
+        std::vector<size_t> roots;
+
+        size_t new_node(const T &min, size_t left, size_t right)
+        {
+            Node node = {min, left, right};
+            this->nodes.push_back(node);
+            return this->nodes.size() - 1;
+        };
+
+        // Builds the subtree covering A[lo..hi].
+        size_t build(size_t lo, size_t hi)
+        {
+            if(lo == hi)
+                return this->new_node(this->A[lo], 0, 0);
+
+            size_t mid = lo + (hi - lo) / 2,
+                   left = this->build(lo, mid),
+                   right = this->build(mid+1, hi);
+            return this->new_node(std::min(this->nodes[left].min,
+                                           this->nodes[right].min),
+                                  left, right);
+        };
+
+        // Returns a copy of the subtree rooted at node (covering [lo, hi])
+        // in which position pos holds value.
+        size_t set(size_t node, size_t lo, size_t hi, size_t pos,
+                   const T &value)
+        {
+            if(lo == hi)
+                return this->new_node(value, 0, 0);
+
+            size_t mid = lo + (hi - lo) / 2,
+                   left = this->nodes[node].left,
+                   right = this->nodes[node].right;
+            if(pos <= mid)
+                left = this->set(left, lo, mid, pos, value);
+            else
+                right = this->set(right, mid+1, hi, pos, value);
+            return this->new_node(std::min(this->nodes[left].min,
+                                           this->nodes[right].min),
+                                  left, right);
+        };
+
+        T min_on(size_t node, size_t lo, size_t hi, size_t i, size_t j) const
+        {
+            if(i <= lo && hi <= j)
+                return this->nodes[node].min;
+
+            size_t mid = lo + (hi - lo) / 2;
+            if(j <= mid)
+                return this->min_on(this->nodes[node].left, lo, mid, i, j);
+            if(i > mid)
+                return this->min_on(this->nodes[node].right, mid+1, hi, i, j);
+            return std::min(this->min_on(this->nodes[node].left, lo, mid, i, j),
+                            this->min_on(this->nodes[node].right, mid+1, hi, i, j));
+        };
+
+        // First (resp. last) position of [i, j] below node (covering
+        // [lo, hi]) whose value is < x. Subtrees outside [i, j] or whose
+        // minimum is not < x are skipped without visiting them.
+        size_t first_less_on(size_t node, size_t lo, size_t hi, size_t i,
+                             size_t j, const T &x) const
+        {
+            if(hi < i || j < lo || !(this->nodes[node].min < x))
+                return RMQ_NOT_FOUND;
+            if(lo == hi)
+                return lo;
+
+            size_t mid = lo + (hi - lo) / 2,
+                   first = this->first_less_on(this->nodes[node].left,
+                                               lo, mid, i, j, x);
+            if(first != RMQ_NOT_FOUND)
+                return first;
+            return this->first_less_on(this->nodes[node].right,
+                                       mid+1, hi, i, j, x);
+        };
+
+        size_t last_less_on(size_t node, size_t lo, size_t hi, size_t i,
+                            size_t j, const T &x) const
+        {
+            if(hi < i || j < lo || !(this->nodes[node].min < x))
+                return RMQ_NOT_FOUND;
+            if(lo == hi)
+                return lo;
+
+            size_t mid = lo + (hi - lo) / 2,
+                   last = this->last_less_on(this->nodes[node].right,
+                                             mid+1, hi, i, j, x);
+            if(last != RMQ_NOT_FOUND)
+                return last;
+            return this->last_less_on(this->nodes[node].left,
+                                      lo, mid, i, j, x);
+        };
+
+    protected:
+        // Like operator(), these answer on the initial version.
+        virtual size_t first_less(size_t i, size_t j, const T &x) const
+        {
+            return this->first_less_on(this->roots[0], 0, this->n-1, i, j, x);
+        };
+
+        virtual size_t last_less(size_t i, size_t j, const T &x) const
+        {
+            return this->last_less_on(this->roots[0], 0, this->n-1, i, j, x);
+        };
+
+    public:
+        PersistentRMQ(const std::vector<T> &A) : RMQ<T>(A)
+        {
+            if(this->n == 0)
+                return;
+
+            this->nodes.reserve(2*this->n);
+            this->roots.push_back(this->build(0, this->n-1));
+        };
+
+        size_t versions() const
+        {
+            return this->roots.size();
+        };
+
+        // Creates a new version equal to v except that position pos holds
+        // value. Takes O(log n) time and space.
+        Version update(Version v, size_t pos, const T &value)
+        {
+            assert(v < this->roots.size() && pos < this->n);
+
+            size_t root = this->set(this->roots[v], 0, this->n-1, pos, value);
+            this->roots.push_back(root);
+            return this->roots.size() - 1;
+        };
+
+        T query(Version v, size_t i, size_t j) const
+        {
+            assert(v < this->roots.size() && i <= j && j < this->n);
+
+            return this->min_on(this->roots[v], 0, this->n-1, i, j);
+        };
+
+        virtual T operator()(size_t i, size_t j) const
+        {
+            return this->query(0, i, j);
+        };
+};
+
+
+template<class T>
+class WideSegmentTreeRMQ : public RMQ<T>
+{
+    // Segment tree with fanout B = 64 / sizeof(T) (16 for 32-bit types), so
+    // that the children of a node fill one cache line. The layout is implicit:
+    // levels[0] holds the elements and the parent of entry e of a level is
+    // entry e / B of the next one. Queries and updates go through
+    // O(log_B n) levels and take the minimum of at most two runs of children
+    // per level with min_reduce (see rmq_simd.h).
+    // Updates modify the tree's own copy of the elements, not A; queries
+    // always answer on the current contents.
+
+    private:
+        enum { B = sizeof(T) <= 32 ? 64 / sizeof(T) : 2 };
+
+        std::vector<std::vector<T> > levels;
+
+        // Minimum of levels[l][from..to].
+        T min_on(size_t l, size_t from, size_t to) const
+        {
+            return min_reduce(&this->levels[l][from], to - from + 1);
+        };
+
+        // Recomputes the parent of levels[l-1][e*B].
+        T children_min(size_t l, size_t e) const
+        {
+            size_t from = e * B,
+                   to = std::min(from + B, this->levels[l-1].size()) - 1;
+            return this->min_on(l-1, from, to);
+        };
+
+        // First (resp. last) entry of levels[l][from..to] that is < x, or
+        // RMQ_NOT_FOUND if there is none.
+        size_t first_in(size_t l, size_t from, size_t to, const T &x) const
+        {
+            for(size_t e = from; e <= to; ++e)
+                if(this->levels[l][e] < x)
+                    return e;
+            return RMQ_NOT_FOUND;
+        };
+
+        size_t last_in(size_t l, size_t from, size_t to, const T &x) const
+        {
+            for(size_t e = to+1; e-- > from; )
+                if(this->levels[l][e] < x)
+                    return e;
+            return RMQ_NOT_FOUND;
+        };
+
+        // Goes down from entry e of level l, which is < x, to the first
+        // (resp. last) element below it that is < x.
+        size_t first_below(size_t l, size_t e, const T &x) const
+        {
+            for(; l > 0; --l)
+                e = this->first_in(l-1, e * B,
+                        std::min((e+1) * B, this->levels[l-1].size()) - 1, x);
+            return e;
+        };
+
+        size_t last_below(size_t l, size_t e, const T &x) const
+        {
+            for(; l > 0; --l)
+                e = this->last_in(l-1, e * B,
+                        std::min((e+1) * B, this->levels[l-1].size()) - 1, x);
+            return e;
+        };
+
+    protected:
+        // Both go up the levels like operator(). The runs on the near side of
+        // [i, j] are checked on the way up; the ones on the far side come
+        // after everything above them, so they are remembered and checked on
+        // the way back down. Once an entry < x is found, one descent to the
+        // elements finishes the search: O(B log_B n) in total.
+        virtual size_t first_less(size_t i, size_t j, const T &x) const
+        {
+            size_t right_from[8 * sizeof(size_t)], right_to[8 * sizeof(size_t)];
+            size_t l = 0;
+            for(; ; ++l)
+            {
+                size_t i_block = i / B, j_block = j / B,
+                       e = this->first_in(l, i, i_block == j_block ?
+                                                j : (i_block+1) * B - 1, x);
+                if(e != RMQ_NOT_FOUND)
+                    return this->first_below(l, e, x);
+                if(i_block == j_block)
+                    break;
+
+                right_from[l] = j_block * B;
+                right_to[l] = j;
+                if(i_block + 1 == j_block)
+                {
+                    ++l;
+                    break;
+                }
+                i = i_block + 1;
+                j = j_block - 1;
+            }
+
+            // l is now the number of remembered runs.
+            while(l-- > 0)
+            {
+                size_t e = this->first_in(l, right_from[l], right_to[l], x);
+                if(e != RMQ_NOT_FOUND)
+                    return this->first_below(l, e, x);
+            }
+            return RMQ_NOT_FOUND;
+        };
+
+        virtual size_t last_less(size_t i, size_t j, const T &x) const
+        {
+            size_t left_from[8 * sizeof(size_t)], left_to[8 * sizeof(size_t)];
+            size_t l = 0;
+            for(; ; ++l)
+            {
+                size_t i_block = i / B, j_block = j / B,
+                       e = this->last_in(l, i_block == j_block ?
+                                            i : j_block * B, j, x);
+                if(e != RMQ_NOT_FOUND)
+                    return this->last_below(l, e, x);
+                if(i_block == j_block)
+                    break;
+
+                left_from[l] = i;
+                left_to[l] = (i_block+1) * B - 1;
+                if(i_block + 1 == j_block)
+                {
+                    ++l;
+                    break;
+                }
+                i = i_block + 1;
+                j = j_block - 1;
+            }
+
+            while(l-- > 0)
+            {
+                size_t e = this->last_in(l, left_from[l], left_to[l], x);
+                if(e != RMQ_NOT_FOUND)
+                    return this->last_below(l, e, x);
+            }
+            return RMQ_NOT_FOUND;
+        };
+
+    public:
+        WideSegmentTreeRMQ(const std::vector<T> &A) : RMQ<T>(A)
+        {
+            if(this->n == 0)
+                return;
+
+            this->levels.push_back(A);
+            while(this->levels.back().size() > 1)
+            {
+                size_t l = this->levels.size(),
+                       size = (this->levels.back().size() + B - 1) / B;
+                this->levels.push_back(std::vector<T>(size));
+                for(size_t e = 0; e < size; ++e)
+                    this->levels[l][e] = this->children_min(l, e);
+            }
+        };
+
+        // Sets position pos to value and updates its ancestors, stopping as
+        // soon as one of them does not change.
+        void update(size_t pos, const T &value)
+        {
+            assert(pos < this->n);
+
+            this->levels[0][pos] = value;
+            for(size_t l = 1; l < this->levels.size(); ++l)
+            {
+                pos /= B;
+                T min = this->children_min(l, pos);
+                if(!(min < this->levels[l][pos]) && !(this->levels[l][pos] < min))
+                    break;
+                this->levels[l][pos] = min;
+            }
+        };
+
+        const T &get(size_t pos) const
+        {
+            assert(pos < this->n);
+            return this->levels[0][pos];
+        };
+
+        virtual T operator()(size_t i, size_t j) const
+        {
+            assert(i <= j && j < this->n);
+
+            T min = this->levels[0][i];
+            for(size_t l = 0; ; ++l)
+            {
+                size_t i_block = i / B, j_block = j / B;
+                if(i_block == j_block)
+                    return std::min(min, this->min_on(l, i, j));
+
+                min = std::min(min, std::min(this->min_on(l, i, (i_block+1) * B - 1),
+                                             this->min_on(l, j_block * B, j)));
+                if(i_block + 1 == j_block)
+                    return min;
+
+                // The whole blocks in between are covered by their parents.
+                i = i_block + 1;
+                j = j_block - 1;
+            }
+        };
+};
+
+
+// Sorts [first, last) with up to `threads` threads: each thread sorts one
+// chunk and the sorted chunks are then merged pairwise, also in parallel.
+template<class I, class C>
+void parallel_sort(I first, I last, C comp, size_t threads)
+{
+    size_t n = last - first;
+    threads = std::max(std::min(threads, n / 1024), (size_t)1);
+    if(threads == 1)
+    {
+        std::sort(first, last, comp);
+        return;
+    }
+
+    std::vector<I> bounds;
+    for(size_t t = 0; t <= threads; ++t)
+        bounds.push_back(first + n * t / threads);
+
+    std::vector<std::thread> workers;
+    for(size_t t = 0; t < threads; ++t)
+        workers.push_back(std::thread(
+            [=]() { std::sort(bounds[t], bounds[t+1], comp); }));
+    for(size_t t = 0; t < workers.size(); ++t)
+        workers[t].join();
+
+    while(bounds.size() > 2)
+    {
+        std::vector<I> merged;
+        workers.clear();
+        for(size_t t = 0; t + 2 < bounds.size(); t += 2)
+        {
+            workers.push_back(std::thread(
+                [=]() { std::inplace_merge(bounds[t], bounds[t+1],
+                                           bounds[t+2], comp); }));
+            merged.push_back(bounds[t]);
+        }
+        if(bounds.size() % 2 == 0)
+            merged.push_back(bounds[bounds.size()-2]);
+        merged.push_back(bounds.back());
+
+        for(size_t t = 0; t < workers.size(); ++t)
+            workers[t].join();
+        bounds.swap(merged);
+    }
+}
+
+
+template<class T, class Rank = uint32_t,
+         class R = CompressedSparseTableRMQ<Rank> >
+class RankRMQ : public RMQ<T>
+{
+    // RMQ for element types that are expensive to compare or copy. The input
+    // is sorted once (in parallel) to replace every element by its dense rank
+    // among the distinct values, and queries are answered by an integer RMQ
+    // over the ranks. R has to provide argmin, whose position is the answer,
+    // so T is only compared while building (and by the threshold searches
+    // to find the rank of x).
+    // Rank must be wide enough to hold the number of distinct values.
+
+    private:
+        // representatives[r] is some position of A holding the value of rank r.
+        std::vector<size_t> representatives;
+        std::vector<Rank> ranks;
+        R rank_rmq;
+
+        std::vector<Rank> rank_reduce(size_t threads)
+        {
+            std::vector<size_t> order(this->n);
+            for(size_t i = 0; i < this->n; ++i)
+                order[i] = i;
+
+            const std::vector<T> &A = this->A;
+            parallel_sort(order.begin(), order.end(),
+                [&A](size_t a, size_t b) { return A[a] < A[b]; }, threads);
+
+            std::vector<Rank> ranks(this->n);
+            for(size_t i = 0; i < this->n; ++i)
+            {
+                if(i == 0 || A[order[i-1]] < A[order[i]])
+                    this->representatives.push_back(order[i]);
+                ranks[order[i]] = this->representatives.size() - 1;
+            }
+            return ranks;
+        };
+
+        // Number of distinct values less than x: A[k] < x iff its rank is
+        // less than this.
+        Rank rank_bound(const T &x) const
+        {
+            const std::vector<T> &A = this->A;
+            return std::lower_bound(this->representatives.begin(),
+                                    this->representatives.end(), x,
+                [&A](size_t p, const T &x) { return A[p] < x; }) -
+                this->representatives.begin();
+        };
+
+    protected:
+        virtual size_t first_less(size_t i, size_t j, const T &x) const
+        {
+            return this->rank_rmq.find_first_less(i, j, this->rank_bound(x));
+        };
+
+        virtual size_t last_less(size_t i, size_t j, const T &x) const
+        {
+            return this->rank_rmq.find_last_less(i, j, this->rank_bound(x));
+        };
+
+    public:
+        RankRMQ(const std::vector<T> &A,
+                size_t threads = std::thread::hardware_concurrency()) :
+            RMQ<T>(A), ranks(this->rank_reduce(threads)), rank_rmq(this->ranks)
+        {
+        };
+
+        // Position of the leftmost minimum of A[i..j].
+        size_t position(size_t i, size_t j) const
+        {
+            return this->rank_rmq.argmin(i, j);
+        };
+
+        virtual T operator()(size_t i, size_t j) const
+        {
+            return this->A[this->position(i, j)];
+        };
+};
+
+// Sliding-window minimum over a whole array (van Herk/Gil-Werman): writes
+// out[i] = min(A[i..i+w-1]) for every i in [0, n-w], so out must have room
+// for n-w+1 elements. The array is cut into blocks of length w; every window
+// is a suffix of one block followed by a prefix of the next, so with the
+// running suffix minima h and prefix minima g of each block the answer is
+// min(h[i], g[i+w-1]). That is 3 comparisons per element for any w. h is
+// computed into out and g is folded into it on the fly, so no other memory
+// is needed.
+template<class T>
+void window_min(const T *A, size_t n, size_t w, T *out)
+{
+    assert(w >= 1 && w <= n);
+
+    size_t m = n - w + 1;
+
+    // h, computed right to left into out. Positions past m are only needed
+    // as running values.
+    for(size_t block = (n-1) / w * w; ; block -= w)
+    {
+        size_t end = std::min(block + w, n);
+        T running = A[end-1];
+        for(size_t p = end; p-- > block; )
+        {
+            running = std::min(running, A[p]);
+            if(p < m)
+                out[p] = running;
+        }
+        if(block == 0)
+            break;
+    }
+
+    // g, left to right, combined with h as soon as g[i+w-1] is known.
+    T running = A[0];
+    for(size_t p = 0, offset = 0; p < n; ++p, ++offset)
+    {
+        if(offset == w)
+            offset = 0;
+        running = offset == 0 ? A[p] : std::min(running, A[p]);
+        if(p >= w-1)
+            out[p - (w-1)] = std::min(out[p - (w-1)], running);
+    }
+}
+
+template<class T>
+std::vector<T> window_min(const std::vector<T> &A, size_t w)
+{
+    assert(w >= 1 && w <= A.size());
+
+    std::vector<T> out(A.size() - w + 1);
+    window_min(&A[0], A.size(), w, &out[0]);
+    return out;
+}
+
 #endif
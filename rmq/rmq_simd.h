@@ -0,0 +1,232 @@
+#ifndef _RMQ_SIMD_H_
+#define _RMQ_SIMD_H_
+
+// Element-wise kernels used while building the RMQ tables. Every kernel has a
+// generic scalar version that works for any T with operator<; arithmetic types
+// get non-template overloads that use AVX-512 or AVX2 when the compiler is
+// allowed to emit them (e.g. make SIMD_FLAGS=-march=native) and fall back to
+// the scalar loop otherwise.
+
+#include <algorithm>
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+
+// out[i] = min(a[i], b[i]) for every i in [0, count). The output may alias
+// either input.
+template<class T>
+inline void min_streams(const T *a, const T *b, T *out, size_t count)
+{
+    for(size_t i = 0; i < count; ++i)
+        out[i] = std::min(a[i], b[i]);
+}
+
+
+// Same as min_streams, but a, b and out are streams of interleaved (min, max)
+// pairs: even positions are min-ed and odd positions are max-ed. count is the
+// number of elements (twice the number of pairs).
+template<class T>
+inline void minmax_streams(const T *a, const T *b, T *out, size_t count)
+{
+    for(size_t i = 0; i < count; i += 2)
+    {
+        out[i] = std::min(a[i], b[i]);
+        out[i+1] = std::max(a[i+1], b[i+1]);
+    }
+}
+
+
+// Minimum of p[0..count), count > 0.
+template<class T>
+inline T min_reduce(const T *p, size_t count)
+{
+    T min = p[0];
+    for(size_t i = 1; i < count; ++i)
+        min = std::min(min, p[i]);
+    return min;
+}
+
+
+// Register width and load/store primitives for the widest instruction set
+// available. 8 and 16-bit lanes need AVX512BW on top of AVX512F, so they are
+// handled separately below.
+#if defined(__AVX512F__)
+    #define RMQ_SIMD_BYTES         64
+    #define RMQ_SIMD_OP(op)        _mm512_##op
+    #define RMQ_SIMD_LOADI(p)      _mm512_loadu_si512((const void*)(p))
+    #define RMQ_SIMD_STOREI(p, v)  _mm512_storeu_si512((void*)(p), v)
+    // Take the even lanes from x and the odd ones from y.
+    #define RMQ_SIMD_BLEND_ODD_EPI32(x, y) \
+        _mm512_mask_blend_epi32((__mmask16)0xAAAA, x, y)
+    #define RMQ_SIMD_BLEND_ODD_PS(x, y) \
+        _mm512_mask_blend_ps((__mmask16)0xAAAA, x, y)
+    #define RMQ_SIMD_BLEND_ODD_PD(x, y) \
+        _mm512_mask_blend_pd((__mmask8)0xAA, x, y)
+#elif defined(__AVX2__)
+    #define RMQ_SIMD_BYTES         32
+    #define RMQ_SIMD_OP(op)        _mm256_##op
+    #define RMQ_SIMD_LOADI(p)      _mm256_loadu_si256((const __m256i*)(p))
+    #define RMQ_SIMD_STOREI(p, v)  _mm256_storeu_si256((__m256i*)(p), v)
+    #define RMQ_SIMD_BLEND_ODD_EPI32(x, y)  _mm256_blend_epi32(x, y, 0xAA)
+    #define RMQ_SIMD_BLEND_ODD_PS(x, y)     _mm256_blend_ps(x, y, 0xAA)
+    #define RMQ_SIMD_BLEND_ODD_PD(x, y)     _mm256_blend_pd(x, y, 0xA)
+#endif
+
+#if defined(__AVX512BW__)
+    #define RMQ_SIMD_BW_BYTES         64
+    #define RMQ_SIMD_BW_OP(op)        _mm512_##op
+    #define RMQ_SIMD_BW_LOADI(p)      _mm512_loadu_si512((const void*)(p))
+    #define RMQ_SIMD_BW_STOREI(p, v)  _mm512_storeu_si512((void*)(p), v)
+#elif defined(__AVX2__)
+    #define RMQ_SIMD_BW_BYTES         32
+    #define RMQ_SIMD_BW_OP(op)        _mm256_##op
+    #define RMQ_SIMD_BW_LOADI(p)      _mm256_loadu_si256((const __m256i*)(p))
+    #define RMQ_SIMD_BW_STOREI(p, v)  _mm256_storeu_si256((__m256i*)(p), v)
+#endif
+
+// Defines a non-template overload of KERNEL for TYPE that processes
+// BYTES/sizeof(TYPE) lanes per iteration with the vector operation VOP and
+// finishes the tail with the scalar operation SOP.
+#define RMQ_SIMD_STREAMS(KERNEL, TYPE, BYTES, LOAD, STORE, VOP, SOP)          \
+    inline void KERNEL(const TYPE *a, const TYPE *b, TYPE *out, size_t count) \
+    {                                                                         \
+        const size_t width = (BYTES) / sizeof(TYPE);                          \
+        size_t i = 0;                                                         \
+        for(; i + width <= count; i += width)                                 \
+            STORE(out + i, VOP(LOAD(a + i), LOAD(b + i)));                    \
+        for(; i < count; ++i)                                                 \
+            out[i] = SOP(a[i], b[i]);                                         \
+    }
+
+#if defined(RMQ_SIMD_BYTES)
+RMQ_SIMD_STREAMS(min_streams, int32_t, RMQ_SIMD_BYTES, RMQ_SIMD_LOADI,
+                 RMQ_SIMD_STOREI, RMQ_SIMD_OP(min_epi32), std::min)
+RMQ_SIMD_STREAMS(min_streams, uint32_t, RMQ_SIMD_BYTES, RMQ_SIMD_LOADI,
+                 RMQ_SIMD_STOREI, RMQ_SIMD_OP(min_epu32), std::min)
+RMQ_SIMD_STREAMS(min_streams, float, RMQ_SIMD_BYTES, RMQ_SIMD_OP(loadu_ps),
+                 RMQ_SIMD_OP(storeu_ps), RMQ_SIMD_OP(min_ps), std::min)
+RMQ_SIMD_STREAMS(min_streams, double, RMQ_SIMD_BYTES, RMQ_SIMD_OP(loadu_pd),
+                 RMQ_SIMD_OP(storeu_pd), RMQ_SIMD_OP(min_pd), std::min)
+#endif
+
+#if defined(RMQ_SIMD_BW_BYTES)
+RMQ_SIMD_STREAMS(min_streams, int8_t, RMQ_SIMD_BW_BYTES, RMQ_SIMD_BW_LOADI,
+              RMQ_SIMD_BW_STOREI, RMQ_SIMD_BW_OP(min_epi8), std::min)
+RMQ_SIMD_STREAMS(min_streams, uint8_t, RMQ_SIMD_BW_BYTES, RMQ_SIMD_BW_LOADI,
+              RMQ_SIMD_BW_STOREI, RMQ_SIMD_BW_OP(min_epu8), std::min)
+RMQ_SIMD_STREAMS(min_streams, int16_t, RMQ_SIMD_BW_BYTES, RMQ_SIMD_BW_LOADI,
+              RMQ_SIMD_BW_STOREI, RMQ_SIMD_BW_OP(min_epi16), std::min)
+RMQ_SIMD_STREAMS(min_streams, uint16_t, RMQ_SIMD_BW_BYTES, RMQ_SIMD_BW_LOADI,
+              RMQ_SIMD_BW_STOREI, RMQ_SIMD_BW_OP(min_epu16), std::min)
+#endif
+
+// Interleaved (min, max) version of RMQ_SIMD_STREAMS: both operations are done
+// on every lane and BLEND keeps the min on even lanes and the max on odd ones.
+#define RMQ_SIMD_MINMAX_STREAMS(TYPE, BYTES, LOAD, STORE, MIN, MAX, BLEND)    \
+    inline void minmax_streams(const TYPE *a, const TYPE *b, TYPE *out,       \
+                               size_t count)                                  \
+    {                                                                         \
+        const size_t width = (BYTES) / sizeof(TYPE);                          \
+        size_t i = 0;                                                         \
+        for(; i + width <= count; i += width)                                 \
+            STORE(out + i, BLEND(MIN(LOAD(a + i), LOAD(b + i)),               \
+                                 MAX(LOAD(a + i), LOAD(b + i))));             \
+        for(; i < count; i += 2)                                              \
+        {                                                                     \
+            out[i] = std::min(a[i], b[i]);                                    \
+            out[i+1] = std::max(a[i+1], b[i+1]);                              \
+        }                                                                     \
+    }
+
+#if defined(RMQ_SIMD_BYTES)
+RMQ_SIMD_MINMAX_STREAMS(int32_t, RMQ_SIMD_BYTES, RMQ_SIMD_LOADI,
+                        RMQ_SIMD_STOREI, RMQ_SIMD_OP(min_epi32),
+                        RMQ_SIMD_OP(max_epi32), RMQ_SIMD_BLEND_ODD_EPI32)
+RMQ_SIMD_MINMAX_STREAMS(uint32_t, RMQ_SIMD_BYTES, RMQ_SIMD_LOADI,
+                        RMQ_SIMD_STOREI, RMQ_SIMD_OP(min_epu32),
+                        RMQ_SIMD_OP(max_epu32), RMQ_SIMD_BLEND_ODD_EPI32)
+RMQ_SIMD_MINMAX_STREAMS(float, RMQ_SIMD_BYTES, RMQ_SIMD_OP(loadu_ps),
+                        RMQ_SIMD_OP(storeu_ps), RMQ_SIMD_OP(min_ps),
+                        RMQ_SIMD_OP(max_ps), RMQ_SIMD_BLEND_ODD_PS)
+RMQ_SIMD_MINMAX_STREAMS(double, RMQ_SIMD_BYTES, RMQ_SIMD_OP(loadu_pd),
+                        RMQ_SIMD_OP(storeu_pd), RMQ_SIMD_OP(min_pd),
+                        RMQ_SIMD_OP(max_pd), RMQ_SIMD_BLEND_ODD_PD)
+#endif
+
+// Defines a min_reduce overload for TYPE. The accumulator starts from p[0]
+// rather than from some largest value, which would be wrong for ranges of
+// +inf. With AVX-512 the tail is handled by a masked min, so a block of up to
+// one register costs a single load; with AVX2 the last (overlapping) register
+// of the range is min-ed in again, which is harmless for a minimum.
+#if defined(__AVX512F__)
+#define RMQ_SIMD_MIN_REDUCE(TYPE, VEC, SUFFIX, MASK)                          \
+    inline TYPE min_reduce(const TYPE *p, size_t count)                       \
+    {                                                                         \
+        const size_t width = 64 / sizeof(TYPE);                               \
+        VEC m = _mm512_set1_##SUFFIX(p[0]);                                   \
+        size_t i = 0;                                                         \
+        for(; i + width <= count; i += width)                                 \
+            m = _mm512_min_##SUFFIX(m, _mm512_loadu_##SUFFIX(p + i));         \
+        if(i < count)                                                         \
+        {                                                                     \
+            MASK mask = (MASK)((1u << (count - i)) - 1);                      \
+            m = _mm512_mask_min_##SUFFIX(m, mask, m,                          \
+                    _mm512_maskz_loadu_##SUFFIX(mask, p + i));                \
+        }                                                                     \
+        return _mm512_reduce_min_##SUFFIX(m);                                 \
+    }
+RMQ_SIMD_MIN_REDUCE(int32_t, __m512i, epi32, __mmask16)
+RMQ_SIMD_MIN_REDUCE(float, __m512, ps, __mmask16)
+RMQ_SIMD_MIN_REDUCE(double, __m512d, pd, __mmask8)
+#elif defined(__AVX2__)
+#define RMQ_SIMD_MIN_REDUCE(TYPE, VEC, LOAD, STORE, MIN)                      \
+    inline TYPE min_reduce(const TYPE *p, size_t count)                       \
+    {                                                                         \
+        const size_t width = 32 / sizeof(TYPE);                               \
+        if(count < width)                                                     \
+            return min_reduce<TYPE>(p, count);                                \
+        VEC m = LOAD(p);                                                      \
+        for(size_t i = width; i + width <= count; i += width)                 \
+            m = MIN(m, LOAD(p + i));                                          \
+        m = MIN(m, LOAD(p + count - width));                                  \
+        TYPE lanes[width];                                                    \
+        STORE(lanes, m);                                                      \
+        return min_reduce<TYPE>(lanes, width);                                \
+    }
+RMQ_SIMD_MIN_REDUCE(int32_t, __m256i, RMQ_SIMD_LOADI, RMQ_SIMD_STOREI,
+                    _mm256_min_epi32)
+RMQ_SIMD_MIN_REDUCE(float, __m256, _mm256_loadu_ps, _mm256_storeu_ps,
+                    _mm256_min_ps)
+RMQ_SIMD_MIN_REDUCE(double, __m256d, _mm256_loadu_pd, _mm256_storeu_pd,
+                    _mm256_min_pd)
+#endif
+
+// 64-bit integer min only exists as a single instruction from AVX-512 on.
+#if defined(__AVX512F__)
+RMQ_SIMD_STREAMS(min_streams, int64_t, 64, RMQ_SIMD_LOADI, RMQ_SIMD_STOREI,
+                 _mm512_min_epi64, std::min)
+RMQ_SIMD_STREAMS(min_streams, uint64_t, 64, RMQ_SIMD_LOADI, RMQ_SIMD_STOREI,
+                 _mm512_min_epu64, std::min)
+#endif
+
+// The helpers are only needed to define the overloads above.
+#undef RMQ_SIMD_BYTES
+#undef RMQ_SIMD_OP
+#undef RMQ_SIMD_LOADI
+#undef RMQ_SIMD_STOREI
+#undef RMQ_SIMD_BLEND_ODD_EPI32
+#undef RMQ_SIMD_BLEND_ODD_PS
+#undef RMQ_SIMD_BLEND_ODD_PD
+#undef RMQ_SIMD_BW_BYTES
+#undef RMQ_SIMD_BW_OP
+#undef RMQ_SIMD_BW_LOADI
+#undef RMQ_SIMD_BW_STOREI
+#undef RMQ_SIMD_STREAMS
+#undef RMQ_SIMD_MINMAX_STREAMS
+#undef RMQ_SIMD_MIN_REDUCE
+
+#endif
@@ -1,4 +1,8 @@
+#include <chrono>
+#include <string>
+#include <thread>
 #include <vector>
+#include <limits>
 #include "gtest/gtest.h"
 #include "rmq.h"
 
@@ -46,3 +50,644 @@ TEST(RMQTest, sparse_rmq_test)
 	EXPECT_EQ(sparse_rmq(1,4), 14);
 	EXPECT_EQ(sparse_rmq(7,9), 23);
 }
+
+template<class T>
+static vector<T> random_vector(size_t n, unsigned seed)
+{
+	srand(seed);
+	vector<T> v(n);
+	for(size_t i = 0; i < n; ++i)
+		v[i] = (T)(rand() % 2000 - 1000);
+	return v;
+}
+
+template<class T>
+static void check_against_naive(const RMQ<T> &rmq, const vector<T> &v)
+{
+	NaiveRMQ<T> naive_rmq(v);
+	for(size_t i = 0; i < v.size(); i += 7)
+		for(size_t j = i; j < v.size(); j += 5)
+			ASSERT_EQ(rmq(i,j), naive_rmq(i,j)) << i << " " << j;
+}
+
+TEST(RMQTest, min_streams_test)
+{
+	// Odd length so that both the vector body and the scalar tail are used.
+	vector<int> a = random_vector<int>(1001, 1), b = random_vector<int>(1001, 2);
+	vector<int> out(a.size());
+	min_streams(&a[0], &b[0], &out[0], a.size());
+	for(size_t i = 0; i < a.size(); ++i)
+		ASSERT_EQ(out[i], min(a[i], b[i]));
+
+	vector<double> c = random_vector<double>(37, 3), d = random_vector<double>(37, 4);
+	min_streams(&c[0], &d[0], &c[0], c.size());
+	for(size_t i = 0; i < c.size(); ++i)
+		ASSERT_LE(c[i], d[i]);
+}
+
+TEST(RMQTest, sparse_rmq_random_test)
+{
+	vector<int> v = random_vector<int>(777, 5);
+	check_against_naive(SparseTableRMQ<int>(v), v);
+
+	vector<short> w = random_vector<short>(300, 6);
+	check_against_naive(SparseTableRMQ<short>(w), w);
+
+	vector<float> x = random_vector<float>(129, 7);
+	check_against_naive(SparseTableRMQ<float>(x), x);
+}
+
+TEST(RMQTest, compressed_sparse_rmq_test)
+{
+	CompressedSparseTableRMQ<int> compressed_rmq(A);
+
+	EXPECT_EQ(compressed_rmq(0,9), -10);
+	EXPECT_EQ(compressed_rmq(2,2), 22);
+	EXPECT_EQ(compressed_rmq(1,4), 14);
+	EXPECT_EQ(compressed_rmq(7,9), 23);
+	EXPECT_EQ(compressed_rmq.argmin(0,9), 6u);
+	EXPECT_EQ(compressed_rmq.argmin(1,4), 3u);
+
+	// Enough elements to use the 8, 16 and 32-bit levels; ties must resolve
+	// to the leftmost position.
+	vector<int> v = random_vector<int>(140000, 8);
+	CompressedSparseTableRMQ<int> rmq(v);
+	for(size_t i = 0; i < v.size(); i += 9973)
+	{
+		size_t k = i;
+		for(size_t j = i; j < v.size(); ++j)
+		{
+			if(v[j] < v[k])
+				k = j;
+			if(j % 101 == 0)
+			{
+				ASSERT_EQ(rmq.argmin(i,j), k) << i << " " << j;
+			}
+		}
+	}
+}
+
+TEST(RMQTest, floor_log2_test)
+{
+	EXPECT_EQ(floor_log2(1), 0u);
+	EXPECT_EQ(floor_log2(2), 1u);
+	EXPECT_EQ(floor_log2(3), 1u);
+	EXPECT_EQ(floor_log2(1024), 10u);
+	EXPECT_EQ(floor_log2((size_t)1 << 31), 31u);
+	EXPECT_EQ(floor_log2(((size_t)1 << 32) + 5), 32u);
+	EXPECT_EQ(floor_log2((size_t)-1), 63u);
+}
+
+TEST(RMQTest, block_rmq_random_test)
+{
+	vector<int> v = random_vector<int>(1000, 9);
+	check_against_naive(BlockRMQ<int>(v), v);
+
+	vector<int> w = random_vector<int>(2, 10);
+	check_against_naive(BlockRMQ<int>(w), w);
+}
+
+// Needs about 4.5GB of memory; run with --gtest_also_run_disabled_tests.
+TEST(RMQTest, DISABLED_large_rmq_test)
+{
+	size_t n = ((size_t)1 << 32) + 5;
+	vector<unsigned char> v(n, 200);
+	v[3] = 100;
+	v[((size_t)1 << 31) + 7] = 50;
+	v[n-2] = 10;
+
+	BlockRMQ<unsigned char> block_rmq(v);
+	EXPECT_EQ(block_rmq(0, n-1), 10);
+	EXPECT_EQ(block_rmq(0, n-3), 50);
+	EXPECT_EQ(block_rmq(0, (size_t)1 << 31), 100);
+	EXPECT_EQ(block_rmq(4, ((size_t)1 << 31) + 6), 200);
+	EXPECT_EQ(block_rmq(n-1, n-1), 200);
+}
+
+// Needs about 66GB of memory (32 levels of 2^31 bytes); run with
+// --gtest_also_run_disabled_tests.
+TEST(RMQTest, DISABLED_large_sparse_rmq_test)
+{
+	size_t half = (size_t)1 << 31, n = half + 9;
+	vector<unsigned char> v(n, 200);
+	v[3] = 100;
+	v[half + 5] = 50;
+	v[n-2] = 10;
+
+	SparseTableRMQ<unsigned char> sparse_rmq(v);
+	EXPECT_EQ(sparse_rmq(0, n-1), 10);
+	EXPECT_EQ(sparse_rmq(0, n-3), 50);
+	EXPECT_EQ(sparse_rmq(0, half), 100);
+	EXPECT_EQ(sparse_rmq(4, half + 4), 200);
+	EXPECT_EQ(sparse_rmq(n-1, n-1), 200);
+	EXPECT_EQ(sparse_rmq.find_first_less(4, n-1, 60), half + 5);
+	EXPECT_EQ(sparse_rmq.find_last_less(0, half + 4, 150), 3u);
+}
+
+TEST(RMQTest, range_min_max_test)
+{
+	RangeMinMax<int> min_max(A);
+
+	EXPECT_EQ(min_max(0,9), -10);
+	EXPECT_EQ(min_max.max(0,9), 82);
+	EXPECT_EQ(min_max.min_max(1,4), make_pair(14, 53));
+	EXPECT_EQ(min_max.min_max(2,2), make_pair(22, 22));
+	EXPECT_EQ(min_max.min_max(7,9), make_pair(23, 82));
+
+	vector<int> v = random_vector<int>(513, 11);
+	RangeMinMax<int> rmq(v);
+	check_against_naive(rmq, v);
+	for(size_t i = 0; i < v.size(); i += 7)
+		for(size_t j = i; j < v.size(); j += 5)
+			ASSERT_EQ(rmq.max(i,j), *max_element(v.begin() + i, v.begin() + j + 1));
+
+	vector<double> w = random_vector<double>(100, 12);
+	check_against_naive(RangeMinMax<double>(w), w);
+}
+
+TEST(RMQTest, range_top_k_test)
+{
+	RangeTopK<int> top_k(A);
+
+	EXPECT_EQ(top_k(0,9,3), vector<int>({-10, 14, 17}));
+	EXPECT_EQ(top_k(7,9,5), vector<int>({23, 72, 82}));
+	EXPECT_EQ(top_k(2,2,1), vector<int>({22}));
+	EXPECT_EQ(top_k.positions(0,5,2), vector<size_t>({3, 4}));
+	// k may be far larger than the range.
+	EXPECT_EQ(top_k(7,9,(size_t)1 << 62), vector<int>({23, 72, 82}));
+	EXPECT_EQ(top_k(vector<pair<size_t, size_t> >(1, make_pair(0, 1)),
+	                (size_t)1 << 62), vector<vector<int> >(1, {45, 53}));
+
+	vector<int> v = random_vector<int>(2000, 13);
+	RangeTopK<int> rmq(v);
+	vector<pair<size_t, size_t> > ranges;
+	for(size_t i = 0; i < v.size(); i += 101)
+		ranges.push_back(make_pair(i, min(v.size() - 1, i + 3*i/2)));
+
+	vector<vector<int> > results = rmq(ranges, 10);
+	for(size_t q = 0; q < ranges.size(); ++q)
+	{
+		vector<int> expected(v.begin() + ranges[q].first,
+		                     v.begin() + ranges[q].second + 1);
+		sort(expected.begin(), expected.end());
+		expected.resize(min(expected.size(), (size_t)10));
+		ASSERT_EQ(results[q], expected);
+		ASSERT_EQ(rmq(ranges[q].first, ranges[q].second, 10), expected);
+	}
+}
+
+TEST(RMQTest, find_less_test)
+{
+	SparseTableRMQ<int> sparse_rmq(A);
+
+	EXPECT_EQ(sparse_rmq.find_first_less(0,9,20), 3u);
+	EXPECT_EQ(sparse_rmq.find_last_less(0,9,20), 6u);
+	EXPECT_EQ(sparse_rmq.find_first_less(7,9,50), 7u);
+	EXPECT_EQ(sparse_rmq.find_last_less(0,2,50), 2u);
+	EXPECT_EQ(sparse_rmq.find_first_less(7,9,23), RMQ_NOT_FOUND);
+	EXPECT_EQ(sparse_rmq.find_last_less(0,0,45), RMQ_NOT_FOUND);
+
+	vector<int> v = random_vector<int>(1500, 14);
+	NaiveRMQ<int> naive_rmq(v);
+	SparseTableRMQ<int> sparse(v);
+	CompressedSparseTableRMQ<int> compressed(v);
+	RangeMinMax<int> min_max(v);
+	const RMQ<int> *rmqs[] = {&sparse, &compressed, &min_max};
+
+	vector<ThresholdQuery<int> > queries;
+	for(size_t i = 0; i < v.size(); i += 37)
+		for(size_t j = i; j < v.size(); j += 53)
+			for(int x = -1000; x <= 1000; x += 250)
+				queries.push_back(make_tuple(i, j, x));
+
+	vector<size_t> first = naive_rmq.find_first_less(queries),
+	               last = naive_rmq.find_last_less(queries);
+	for(size_t r = 0; r < 3; ++r)
+	{
+		ASSERT_EQ(rmqs[r]->find_first_less(queries), first);
+		ASSERT_EQ(rmqs[r]->find_last_less(queries), last);
+	}
+}
+
+// Input that counts how many elements are read from it.
+struct CountingInput
+{
+	const vector<int> &values;
+	mutable size_t reads;
+
+	size_t size() const { return values.size(); }
+	int operator[](size_t i) const { ++reads; return values[i]; }
+};
+
+TEST(RMQTest, sparse_table_descent_test)
+{
+	// SparseTableRMQ keeps a copy of A as its level 0, so its threshold
+	// searches should only look at the table and never read the input.
+	vector<int> v = random_vector<int>(1 << 16, 16);
+	CountingInput input = {v, 0};
+	SparseTableRMQ<int, CountingInput> sparse(input);
+	NaiveRMQ<int> naive_rmq(v);
+
+	input.reads = 0;
+	for(size_t i = 0; i < v.size(); i += 4099)
+		for(int x = -1000; x <= 1000; x += 100)
+		{
+			ASSERT_EQ(sparse.find_first_less(i, v.size() - 1, x),
+			          naive_rmq.find_first_less(i, v.size() - 1, x));
+			ASSERT_EQ(sparse.find_last_less(0, i, x),
+			          naive_rmq.find_last_less(0, i, x));
+		}
+	EXPECT_EQ(input.reads, 0u);
+}
+
+TEST(RMQTest, rank_rmq_test)
+{
+	vector<string> words({"pear", "fig", "plum", "apple", "kiwi", "fig",
+	                      "lime", "date", "apple", "quince"});
+	RankRMQ<string> rank_rmq(words);
+
+	EXPECT_EQ(rank_rmq(0,9), "apple");
+	EXPECT_EQ(rank_rmq(0,2), "fig");
+	EXPECT_EQ(rank_rmq(4,7), "date");
+	EXPECT_EQ(rank_rmq(9,9), "quince");
+	EXPECT_EQ(rank_rmq.find_first_less(0,9,"fig"), 3u);
+	EXPECT_EQ(rank_rmq.find_last_less(0,9,"apple"), RMQ_NOT_FOUND);
+	// The leftmost minimum, inside the range even with repeated values.
+	EXPECT_EQ(rank_rmq.position(0,9), 3u);
+	EXPECT_EQ(rank_rmq.position(5,9), 8u);
+	EXPECT_EQ(rank_rmq.position(5,5), 5u);
+
+	// Large enough to sort with several threads.
+	vector<int> v = random_vector<int>(10000, 15);
+	RankRMQ<int> rmq(v, 4);
+	SparseTableRMQ<int> sparse_rmq(v);
+	for(size_t i = 0; i < v.size(); i += 31)
+		for(size_t j = i; j < v.size(); j += 17)
+		{
+			ASSERT_EQ(rmq(i,j), sparse_rmq(i,j)) << i << " " << j;
+			size_t p = rmq.position(i,j);
+			ASSERT_TRUE(p >= i && p <= j && v[p] == rmq(i,j) &&
+			            (p == i || rmq(i,p-1) > v[p])) << i << " " << j;
+		}
+}
+
+TEST(RMQTest, lazy_sparse_rmq_test)
+{
+	LazySparseTableRMQ<int> lazy_rmq(A);
+
+	EXPECT_EQ(lazy_rmq(2,2), 22);
+	EXPECT_EQ(lazy_rmq.levels_built(), 1u);
+	EXPECT_EQ(lazy_rmq(1,4), 14);
+	EXPECT_EQ(lazy_rmq.levels_built(), 3u);
+	EXPECT_EQ(lazy_rmq(7,9), 23);
+	EXPECT_EQ(lazy_rmq.levels_built(), 3u);
+	EXPECT_EQ(lazy_rmq(0,9), -10);
+	EXPECT_EQ(lazy_rmq.levels_built(), 4u);
+
+	// Several threads racing to materialize the same levels.
+	vector<int> v = random_vector<int>(3000, 16);
+	LazySparseTableRMQ<int> rmq(v);
+	SparseTableRMQ<int> sparse_rmq(v);
+	vector<thread> threads;
+	vector<int> failures(4, 0);
+	for(size_t t = 0; t < 4; ++t)
+		threads.push_back(thread([&, t]() {
+			for(size_t i = t; i < v.size(); i += 41)
+				for(size_t j = i; j < v.size(); j += 29)
+					failures[t] += rmq(i,j) != sparse_rmq(i,j);
+		}));
+	for(size_t t = 0; t < threads.size(); ++t)
+		threads[t].join();
+
+	EXPECT_EQ(failures, vector<int>(4, 0));
+	EXPECT_EQ(rmq.levels_built(), floor_log2(v.size()) + 1);
+}
+
+TEST(RMQTest, multi_column_rmq_test)
+{
+	vector<int> B({3, 1, 4, 1, 5, 9, 2, 6, 5, 3});
+	MultiColumnRMQ<int> multi_rmq(vector<vector<int> >({A, B}));
+
+	EXPECT_EQ(multi_rmq.columns(), 2u);
+	EXPECT_EQ(multi_rmq(0,9), vector<int>({-10, 1}));
+	EXPECT_EQ(multi_rmq(2,2), vector<int>({22, 4}));
+	EXPECT_EQ(multi_rmq(4,8), vector<int>({-10, 2}));
+
+	vector<vector<float> > columns;
+	for(unsigned c = 0; c < 19; ++c)
+		columns.push_back(random_vector<float>(600, 100 + c));
+	MultiColumnRMQ<float> rmq(columns);
+	vector<float> mins(columns.size());
+	for(size_t i = 0; i < 600; i += 13)
+		for(size_t j = i; j < 600; j += 11)
+		{
+			rmq(i, j, &mins[0]);
+			for(size_t c = 0; c < columns.size(); ++c)
+				ASSERT_EQ(mins[c], *min_element(columns[c].begin() + i,
+				                                columns[c].begin() + j + 1));
+		}
+}
+
+TEST(RMQTest, persistent_rmq_test)
+{
+	PersistentRMQ<int> persistent_rmq(A);
+
+	EXPECT_EQ(persistent_rmq(0,9), -10);
+	EXPECT_EQ(persistent_rmq(2,2), 22);
+	EXPECT_EQ(persistent_rmq(1,4), 14);
+	EXPECT_EQ(persistent_rmq(7,9), 23);
+
+	PersistentRMQ<int>::Version v1 = persistent_rmq.update(0, 6, 100),
+	                            v2 = persistent_rmq.update(v1, 8, -5),
+	                            v3 = persistent_rmq.update(0, 2, 0);
+
+	EXPECT_EQ(persistent_rmq.versions(), 4u);
+	EXPECT_EQ(persistent_rmq.query(v1, 0, 9), 14);
+	EXPECT_EQ(persistent_rmq.query(v2, 0, 9), -5);
+	EXPECT_EQ(persistent_rmq.query(v2, 0, 7), 14);
+	EXPECT_EQ(persistent_rmq.query(v3, 0, 9), -10);
+	EXPECT_EQ(persistent_rmq.query(v3, 0, 5), 0);
+	EXPECT_EQ(persistent_rmq.query(0, 0, 9), -10);
+
+	// Random updates checked against a full copy of every version.
+	vector<int> v = random_vector<int>(300, 17);
+	PersistentRMQ<int> rmq(v);
+	vector<vector<int> > copies(1, v);
+	for(size_t u = 0; u < 200; ++u)
+	{
+		size_t from = rand() % copies.size(), pos = rand() % v.size();
+		int value = rand() % 2000 - 1000;
+		ASSERT_EQ(rmq.update(from, pos, value), copies.size());
+		copies.push_back(copies[from]);
+		copies.back()[pos] = value;
+	}
+	for(size_t version = 0; version < copies.size(); version += 7)
+	{
+		NaiveRMQ<int> naive_rmq(copies[version]);
+		for(size_t i = 0; i < v.size(); i += 11)
+			for(size_t j = i; j < v.size(); j += 13)
+				ASSERT_EQ(rmq.query(version, i, j), naive_rmq(i,j));
+	}
+
+	// Threshold searches answer on the initial version.
+	NaiveRMQ<int> naive_rmq(v);
+	for(size_t i = 0; i < v.size(); i += 7)
+		for(size_t j = i; j < v.size(); j += 11)
+			for(int x = -1000; x <= 1000; x += 125)
+			{
+				ASSERT_EQ(rmq.find_first_less(i, j, x),
+				          naive_rmq.find_first_less(i, j, x));
+				ASSERT_EQ(rmq.find_last_less(i, j, x),
+				          naive_rmq.find_last_less(i, j, x));
+			}
+}
+
+TEST(RMQTest, min_reduce_test)
+{
+	for(size_t n = 1; n <= 40; ++n)
+	{
+		vector<int> v = random_vector<int>(n, 200 + n);
+		vector<float> w = random_vector<float>(n, 300 + n);
+		ASSERT_EQ(min_reduce(&v[0], n), *min_element(v.begin(), v.end()));
+		ASSERT_EQ(min_reduce(&w[0], n), *min_element(w.begin(), w.end()));
+	}
+
+	// +inf (often used as "empty") has to come out as such, not as the
+	// largest finite value.
+	const float inf = numeric_limits<float>::infinity();
+	for(size_t n = 1; n <= 40; ++n)
+	{
+		vector<float> w(n, inf);
+		vector<double> d(n, numeric_limits<double>::infinity());
+		ASSERT_EQ(min_reduce(&w[0], n), inf);
+		ASSERT_EQ(min_reduce(&d[0], n), d[0]);
+	}
+
+	vector<float> w(100, inf);
+	NaiveRMQ<float> naive_rmq(w);
+	BlockRMQ<float> block_rmq(w);
+	WideSegmentTreeRMQ<float> wide_rmq(w);
+	EXPECT_EQ(naive_rmq(0,99), inf);
+	EXPECT_EQ(block_rmq(3,90), inf);
+	EXPECT_EQ(wide_rmq(0,99), inf);
+	wide_rmq.update(50, 1.5f);
+	EXPECT_EQ(wide_rmq(0,99), 1.5f);
+	EXPECT_EQ(wide_rmq(51,99), inf);
+}
+
+TEST(RMQTest, wide_segment_tree_rmq_test)
+{
+	WideSegmentTreeRMQ<int> wide_rmq(A);
+
+	EXPECT_EQ(wide_rmq(0,9), -10);
+	EXPECT_EQ(wide_rmq(2,2), 22);
+	EXPECT_EQ(wide_rmq(1,4), 14);
+	EXPECT_EQ(wide_rmq(7,9), 23);
+	wide_rmq.update(6, 100);
+	EXPECT_EQ(wide_rmq(0,9), 14);
+	EXPECT_EQ(wide_rmq.find_first_less(5,9,30), 5u);
+	EXPECT_EQ(wide_rmq.find_last_less(5,9,30), 7u);
+
+	// Three levels of 16-way nodes plus random updates.
+	vector<int> v = random_vector<int>(5000, 18);
+	WideSegmentTreeRMQ<int> rmq(v);
+	for(size_t u = 0; u < 500; ++u)
+	{
+		size_t pos = rand() % v.size();
+		v[pos] = rand() % 2000 - 1000;
+		rmq.update(pos, v[pos]);
+	}
+	SparseTableRMQ<int> sparse_rmq(v);
+	for(size_t i = 0; i < v.size(); i += 23)
+		for(size_t j = i; j < v.size(); j += 19)
+			ASSERT_EQ(rmq(i,j), sparse_rmq(i,j)) << i << " " << j;
+
+	// Threshold searches, including trees of one and two levels.
+	size_t sizes[] = {1, 16, 17, 300, 5000};
+	for(size_t s = 0; s < 5; ++s)
+	{
+		vector<int> w = random_vector<int>(sizes[s], 19);
+		WideSegmentTreeRMQ<int> wide(w);
+		NaiveRMQ<int> naive_rmq(w);
+		for(size_t i = 0; i < w.size(); i += 7)
+			for(size_t j = i; j < w.size(); j += 11)
+				for(int x = -1000; x <= 1000; x += 125)
+				{
+					ASSERT_EQ(wide.find_first_less(i, j, x),
+					          naive_rmq.find_first_less(i, j, x));
+					ASSERT_EQ(wide.find_last_less(i, j, x),
+					          naive_rmq.find_last_less(i, j, x));
+				}
+	}
+}
+
+// Binary segment tree used as a baseline by the benchmark below.
+class BinarySegmentTree
+{
+	size_t n;
+	vector<int> tree;
+
+public:
+	BinarySegmentTree(const vector<int> &v) : n(v.size()), tree(2*v.size())
+	{
+		copy(v.begin(), v.end(), tree.begin() + n);
+		for(size_t i = n-1; i > 0; --i)
+			tree[i] = min(tree[2*i], tree[2*i+1]);
+	}
+
+	void update(size_t pos, int value)
+	{
+		for(tree[pos += n] = value; pos > 1; pos /= 2)
+			tree[pos/2] = min(tree[pos], tree[pos^1]);
+	}
+
+	int operator()(size_t i, size_t j) const
+	{
+		int m = tree[i + n];
+		for(i += n, j += n+1; i < j; i /= 2, j /= 2)
+		{
+			if(i & 1) m = min(m, tree[i++]);
+			if(j & 1) m = min(m, tree[--j]);
+		}
+		return m;
+	}
+};
+
+template<class F>
+static double seconds(F f)
+{
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	f();
+	return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+// Run with --gtest_also_run_disabled_tests.
+TEST(RMQTest, DISABLED_wide_segment_tree_benchmark)
+{
+	const size_t n = 1 << 22, ops = 1 << 22;
+	vector<int> v = random_vector<int>(n, 19);
+	vector<size_t> positions(ops), lengths(ops);
+	for(size_t k = 0; k < ops; ++k)
+	{
+		positions[k] = rand() % n;
+		lengths[k] = rand() % min(n - positions[k], (size_t)1 << (rand() % 22));
+	}
+
+	WideSegmentTreeRMQ<int> wide(v);
+	BinarySegmentTree binary(v);
+	SparseTableRMQ<int> sparse(v);
+	long checksum[3] = {0, 0, 0};
+
+	double wide_updates = seconds([&]() {
+		for(size_t k = 0; k < ops; ++k)
+			wide.update(positions[k], (int)lengths[k]);
+	});
+	double binary_updates = seconds([&]() {
+		for(size_t k = 0; k < ops; ++k)
+			binary.update(positions[k], (int)lengths[k]);
+	});
+	double wide_queries = seconds([&]() {
+		for(size_t k = 0; k < ops; ++k)
+			checksum[0] += wide(positions[k], positions[k] + lengths[k]);
+	});
+	double binary_queries = seconds([&]() {
+		for(size_t k = 0; k < ops; ++k)
+			checksum[1] += binary(positions[k], positions[k] + lengths[k]);
+	});
+	double sparse_queries = seconds([&]() {
+		for(size_t k = 0; k < ops; ++k)
+			checksum[2] += sparse(positions[k], positions[k] + lengths[k]);
+	});
+	EXPECT_EQ(checksum[0], checksum[1]);
+
+	printf("n = %zu, %zu operations (Mops/s)\n", n, ops);
+	printf("  updates: wide %.1f, binary %.1f\n",
+	       ops / wide_updates / 1e6, ops / binary_updates / 1e6);
+	printf("  queries: wide %.1f, binary %.1f, sparse table %.1f\n",
+	       ops / wide_queries / 1e6, ops / binary_queries / 1e6,
+	       ops / sparse_queries / 1e6);
+}
+
+TEST(RMQTest, window_min_test)
+{
+	EXPECT_EQ(window_min(A, 1), A);
+	EXPECT_EQ(window_min(A, 3), vector<int>({22, 14, 14, 14, -10, -10, -10, 23}));
+	EXPECT_EQ(window_min(A, 10), vector<int>({-10}));
+
+	vector<int> v = random_vector<int>(1000, 20);
+	NaiveRMQ<int> naive_rmq(v);
+	vector<int> out(v.size());
+	size_t widths[] = {1, 2, 7, 16, 31, 100, 999, 1000};
+	for(size_t k = 0; k < 8; ++k)
+	{
+		size_t w = widths[k];
+		window_min(&v[0], v.size(), w, &out[0]);
+		for(size_t i = 0; i + w <= v.size(); ++i)
+			ASSERT_EQ(out[i], naive_rmq(i, i+w-1)) << w << " " << i;
+	}
+
+	vector<string> words({"pear", "fig", "plum", "apple", "kiwi"});
+	EXPECT_EQ(window_min(words, 2),
+	          vector<string>({"fig", "fig", "apple", "apple"}));
+}
+
+TEST(RMQTest, packed_array_test)
+{
+	vector<int> v({1000, 2999, 1500, 1000, 2047});
+	PackedArray<int> packed(v);
+	EXPECT_EQ(packed.size(), 5u);
+	EXPECT_EQ(packed.width(), 11u);
+	for(size_t i = 0; i < v.size(); ++i)
+		EXPECT_EQ(packed[i], v[i]);
+
+	// Widths that do and do not divide 64, signed and 64-bit values.
+	vector<int> w = random_vector<int>(1000, 21);
+	PackedArray<int> packed_w(w);
+	vector<int> out(w.size());
+	packed_w.unpack(3, 990, &out[0]);
+	for(size_t i = 0; i < 990; ++i)
+		ASSERT_EQ(out[i], w[i+3]);
+
+	vector<int64_t> big({-((int64_t)1 << 62), (int64_t)1 << 62, 7, -7, 0,
+	                     3, 4, 5, 6, 8, 9});
+	PackedArray<int64_t> packed_big(big);
+	vector<int64_t> big_out(big.size());
+	packed_big.unpack(0, big.size(), &big_out[0]);
+	EXPECT_EQ(packed_big.width(), 64u);
+	EXPECT_EQ(big_out, big);
+
+	vector<unsigned char> same(100, 42);
+	PackedArray<unsigned char> packed_same(same);
+	EXPECT_EQ(packed_same.width(), 0u);
+	EXPECT_EQ(packed_same[99], 42);
+}
+
+TEST(RMQTest, packed_input_rmq_test)
+{
+	vector<int> v = random_vector<int>(900, 22);
+	PackedArray<int> packed(v);
+	EXPECT_LT(packed.memory(), v.size() * sizeof(int) / 2);
+
+	NaiveRMQ<int> naive_rmq(v);
+	NaiveRMQ<int, PackedArray<int> > packed_naive(packed);
+	BlockRMQ<int, PackedArray<int> > packed_block(packed);
+	SparseTableRMQ<int, PackedArray<int> > packed_sparse(packed);
+	CompressedSparseTableRMQ<int, PackedArray<int> > packed_compressed(packed);
+	RangeMinMax<int, PackedArray<int> > packed_min_max(packed);
+	CompressedSparseTableRMQ<int> compressed(v);
+
+	for(size_t i = 0; i < v.size(); i += 7)
+		for(size_t j = i; j < v.size(); j += 5)
+		{
+			int min = naive_rmq(i,j);
+			ASSERT_EQ(packed_naive(i,j), min);
+			ASSERT_EQ(packed_block(i,j), min);
+			ASSERT_EQ(packed_sparse(i,j), min);
+			ASSERT_EQ(packed_compressed(i,j), min);
+			ASSERT_EQ(packed_compressed.argmin(i,j), compressed.argmin(i,j));
+			ASSERT_EQ(packed_min_max(i,j), min);
+		}
+
+	EXPECT_EQ(packed_sparse.find_first_less(0, 899, -900),
+	          naive_rmq.find_first_less(0, 899, -900));
+}
@@ -0,0 +1,371 @@
+#ifndef __CONCURRENT_VEB_H__
+#define __CONCURRENT_VEB_H__
+
+// Concurrent van Emde Boas tree. The universe is split into shards by the high
+// part of the keys (i.e., into top-level clusters), each of them a BasicvEBTree
+// guarded with the Left-Right technique (P. Ramalhete and A. Correia,
+// "Left-Right: A Concurrency Control Technique with Wait-Free Population
+// Oblivious Reads"):
+//   * Every shard is stored twice. Readers use the currently published copy
+//     and never block or retry.
+//   * Writers of a shard are serialized by a mutex of that shard only. A
+//     writer updates the copy that is not published, publishes it, waits
+//     until no reader is left on the old one and then updates that one too.
+// Readers never see a node while it is being modified or after it has been
+// freed, so no further memory reclamation scheme is needed. The price is
+// twice the memory and twice the work for every update.
+//
+// Every operation is atomic with respect to its shard. successor and
+// predecessor may go on to the following shards, which they look at one after
+// the other rather than as a single snapshot of the whole tree.
+
+#include "veb.h"
+#include <atomic>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#define CACHE_LINE_SIZE 64
+
+
+template<class K>
+class BasicConcurrentvEBTree
+{
+    // Number of readers inside, alone in its cache line.
+    struct alignas(CACHE_LINE_SIZE) ReadIndicator
+    {
+        std::atomic<long> count;
+    };
+
+    struct Shard
+    {
+        BasicvEBTree<K> left, right;
+        // Copy used by readers, and the read indicator they announce
+        // themselves in.
+        std::atomic<int> published, version;
+        ReadIndicator readers[2];
+        std::mutex writer;
+
+        Shard(K universe, int options) :
+            left(universe, options), right(universe, options),
+            published(0), version(0)
+        {
+            this->readers[0].count = 0;
+            this->readers[1].count = 0;
+        };
+
+        BasicvEBTree<K> &tree(int i)
+        {
+            return i == 0 ? this->left : this->right;
+        };
+
+        // The read indicators make Shard over-aligned, which plain new only
+        // honors from C++17 on.
+        static void *operator new(size_t size)
+        {
+            void *p;
+            if(posix_memalign(&p, alignof(Shard), size) != 0)
+                throw std::bad_alloc();
+            return p;
+        };
+
+        static void operator delete(void *p)
+        {
+            free(p);
+        };
+    };
+
+    std::vector<Shard*> shards;
+    // One bit per shard, set while the shard might hold some key. Queries
+    // skip shards with a cleared bit.
+    std::vector<std::atomic<uint64_t>> non_empty;
+    K shard_size;
+
+    template<class F>
+    void read(Shard&, F) const;
+    template<class F>
+    void write(Shard&, F);
+
+    size_t shard_index(K) const;
+    void mark(size_t, bool);
+    bool next_shard(size_t&) const;
+    bool previous_shard(size_t&) const;
+
+public:
+    BasicConcurrentvEBTree(K, size_t num_shards = 256,
+                           int options = VEB_LAZY_CLUSTERS);
+    BasicConcurrentvEBTree(const BasicConcurrentvEBTree&) = delete;
+    ~BasicConcurrentvEBTree();
+
+    const BasicConcurrentvEBTree &operator=(
+        const BasicConcurrentvEBTree&) = delete;
+
+    // Return whether the tree was modified.
+    bool insert(K);
+    bool remove(K);
+
+    bool contains(K) const;
+    bool is_empty() const;
+    // Return false if there is no such key.
+    bool successor(K, K&) const;
+    bool predecessor(K, K&) const;
+};
+
+
+template<class K>
+BasicConcurrentvEBTree<K>::BasicConcurrentvEBTree(K n, size_t num_shards,
+                                                  int options) :
+    non_empty((num_shards + 63) / 64)
+{
+    this->shard_size = (n - 1) / num_shards + 1;
+    num_shards = (n - 1) / this->shard_size + 1;
+
+    for(size_t i = 0; i < num_shards; ++i)
+        this->shards.push_back(new Shard(this->shard_size, options));
+    for(size_t i = 0; i < this->non_empty.size(); ++i)
+        this->non_empty[i] = 0;
+}
+
+template<class K>
+BasicConcurrentvEBTree<K>::~BasicConcurrentvEBTree()
+{
+    for(size_t i = 0; i < this->shards.size(); ++i)
+        delete this->shards[i];
+}
+
+template<class K>
+template<class F>
+void BasicConcurrentvEBTree<K>::read(Shard &shard, F f) const
+{
+    // Calls f on the published copy of the shard.
+
+    int version = shard.version.load();
+    shard.readers[version].count.fetch_add(1);
+    f((const BasicvEBTree<K>&)shard.tree(shard.published.load()));
+    shard.readers[version].count.fetch_sub(1);
+}
+
+template<class K>
+template<class F>
+void BasicConcurrentvEBTree<K>::write(Shard &shard, F f)
+{
+    // Calls f on both copies of the shard. The caller must hold its writer
+    // mutex.
+
+    int published = shard.published.load();
+    f(shard.tree(1 - published));
+    shard.published.store(1 - published);
+
+    // Readers that loaded the old copy announced themselves in the current
+    // read indicator. Move new readers to the other one (once the last ones
+    // to use it are gone) and wait for the current one to drain.
+    int version = shard.version.load();
+    while(shard.readers[1 - version].count.load() != 0)
+        std::this_thread::yield();
+    shard.version.store(1 - version);
+    while(shard.readers[version].count.load() != 0)
+        std::this_thread::yield();
+
+    f(shard.tree(published));
+}
+
+template<class K>
+size_t BasicConcurrentvEBTree<K>::shard_index(K key) const
+{
+    return key / this->shard_size;
+}
+
+template<class K>
+void BasicConcurrentvEBTree<K>::mark(size_t index, bool non_empty)
+{
+    uint64_t bit = (uint64_t)1 << (index % 64);
+    if(non_empty)
+        this->non_empty[index / 64].fetch_or(bit);
+    else
+        this->non_empty[index / 64].fetch_and(~bit);
+}
+
+template<class K>
+bool BasicConcurrentvEBTree<K>::next_shard(size_t &index) const
+{
+    // Moves index to the first shard from index onwards that is marked as
+    // non-empty.
+
+    for(size_t word = index / 64; word < this->non_empty.size(); ++word)
+    {
+        uint64_t bits = this->non_empty[word].load();
+        if(word == index / 64)
+            bits &= ~(uint64_t)0 << (index % 64);
+        if(bits != 0)
+        {
+            index = word * 64 + __builtin_ctzll(bits);
+            return index < this->shards.size();
+        }
+    }
+    return false;
+}
+
+template<class K>
+bool BasicConcurrentvEBTree<K>::previous_shard(size_t &index) const
+{
+    // Same as next_shard, from index backwards.
+
+    for(size_t word = index / 64 + 1; word-- > 0;)
+    {
+        uint64_t bits = this->non_empty[word].load();
+        if(word == index / 64)
+            bits &= ((uint64_t)2 << (index % 64)) - 1;
+        if(bits != 0)
+        {
+            index = word * 64 + 63 - __builtin_clzll(bits);
+            return true;
+        }
+    }
+    return false;
+}
+
+template<class K>
+bool BasicConcurrentvEBTree<K>::insert(K key)
+{
+    size_t index = this->shard_index(key);
+    Shard &shard = *this->shards[index];
+    K value = key - index * this->shard_size;
+
+    std::lock_guard<std::mutex> lock(shard.writer);
+    // Only writers modify the shard, so it can be read without announcing.
+    if(shard.tree(shard.published.load()).contains(value))
+        return false;
+
+    // Marked first, so that the key can never be skipped by other queries.
+    this->mark(index, true);
+    this->write(shard, [value](BasicvEBTree<K> &t) {
+        t.insert(value);
+    });
+    return true;
+}
+
+template<class K>
+bool BasicConcurrentvEBTree<K>::remove(K key)
+{
+    size_t index = this->shard_index(key);
+    Shard &shard = *this->shards[index];
+    K value = key - index * this->shard_size;
+
+    std::lock_guard<std::mutex> lock(shard.writer);
+    if(!shard.tree(shard.published.load()).contains(value))
+        return false;
+
+    this->write(shard, [value](BasicvEBTree<K> &t) {
+        t.remove(value);
+    });
+    if(shard.tree(shard.published.load()).is_empty())
+        this->mark(index, false);
+    return true;
+}
+
+template<class K>
+bool BasicConcurrentvEBTree<K>::contains(K key) const
+{
+    size_t index = this->shard_index(key);
+    K value = key - index * this->shard_size;
+    bool found;
+
+    this->read(*this->shards[index], [&](const BasicvEBTree<K> &t) {
+        found = t.contains(value);
+    });
+    return found;
+}
+
+template<class K>
+bool BasicConcurrentvEBTree<K>::is_empty() const
+{
+    size_t index = 0;
+    bool empty = true;
+
+    for(; empty && this->next_shard(index); ++index)
+        this->read(*this->shards[index], [&](const BasicvEBTree<K> &t) {
+            empty = t.is_empty();
+        });
+    return empty;
+}
+
+template<class K>
+bool BasicConcurrentvEBTree<K>::successor(K key, K &result) const
+{
+    size_t index = this->shard_index(key);
+    K value = key - index * this->shard_size;
+    bool found = false;
+
+    // Within the shard of the key first...
+    this->read(*this->shards[index], [&](const BasicvEBTree<K> &t) {
+        if(!t.is_empty() && value < t.get_max())
+        {
+            result = t.successor(value);
+            found = true;
+        }
+    });
+
+    // ... or else the minimum of the next non-empty shard.
+    while(!found)
+    {
+        ++index;
+        if(!this->next_shard(index))
+            break;
+        this->read(*this->shards[index], [&](const BasicvEBTree<K> &t) {
+            if(!t.is_empty())
+            {
+                result = t.get_min();
+                found = true;
+            }
+        });
+    }
+
+    if(found)
+        result += index * this->shard_size;
+    return found;
+}
+
+template<class K>
+bool BasicConcurrentvEBTree<K>::predecessor(K key, K &result) const
+{
+    size_t index = this->shard_index(key);
+    K value = key - index * this->shard_size;
+    bool found = false;
+
+    this->read(*this->shards[index], [&](const BasicvEBTree<K> &t) {
+        if(!t.is_empty() && value > t.get_min())
+        {
+            result = t.predecessor(value);
+            found = true;
+        }
+    });
+
+    while(!found && index > 0)
+    {
+        --index;
+        if(!this->previous_shard(index))
+            break;
+        this->read(*this->shards[index], [&](const BasicvEBTree<K> &t) {
+            if(!t.is_empty())
+            {
+                result = t.get_max();
+                found = true;
+            }
+        });
+    }
+
+    if(found)
+        result += index * this->shard_size;
+    return found;
+}
+
+// Type aliases, as for BasicvEBTree.
+typedef BasicConcurrentvEBTree<int> ConcurrentvEBTree;
+typedef BasicConcurrentvEBTree<uint32_t> ConcurrentvEBTree32;
+typedef BasicConcurrentvEBTree<uint64_t> ConcurrentvEBTree64;
+
+#endif
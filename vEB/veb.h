@@ -2,45 +2,2086 @@
 #define __VEB_H__
 
 #include <vector>
+#include <limits>
+#include <memory>
+#include <utility>
+#include <algorithm>
+#include <thread>
+#include <unordered_map>
+#include <type_traits>
+#include <assert.h>
+#include <math.h>
 #include <stddef.h>
+#include <stdint.h>
 
-class vEBTree
+#ifdef VEB_STATS
+#include <atomic>
+#endif
+
+// Construction options (bitwise OR of these flags).
+enum vEBOptions
+{
+    VEB_DEFAULT = 0,
+    // Allocate clusters (and the summary) only when they first become
+    // non-empty and free them when they become empty again, so that memory
+    // depends on the stored keys instead of on the universe size.
+    VEB_LAZY_CLUSTERS = 1,
+    // Round the universe up to a power of two and split keys into their high
+    // and low halves of bits, so that finding a cluster takes a shift and a
+    // mask instead of a division.
+    VEB_POWER_OF_TWO = 2
+};
+
+// Universes up to this size are stored as a single bit set (leaf node)
+// instead of being split further.
+#define VEB_LEAF_UNIVERSE 64
+
+// In lazy trees, nodes with more clusters than this keep them in a hash map
+// holding only the non-empty ones instead of in an array. This is what makes
+// 64-bit universes possible: the top node of one has 2^32 clusters.
+#define VEB_MAX_DENSE_CLUSTERS 1024
+
+// Number of keys that iterators fetch from the tree at once.
+#define VEB_ITERATOR_BATCH 32
+
+// Payload type of trees that only store keys (sets). Nodes have room to spare
+// for it, so it does not make them any larger.
+struct vEBNoValue {};
+
+template<class K, class V>
+class BasicvEBMap;
+
+// Statistics are only kept if VEB_STATS is defined (for the whole program,
+// e.g. with -DVEB_STATS). Otherwise they are compiled out and cost nothing.
+#ifdef VEB_STATS
+
+// Number of recent calls that recursion depths are averaged over.
+#define VEB_STATS_WINDOW 1024
+// Recursion levels that cluster counts are kept for.
+#define VEB_STATS_LEVELS 32
+
+struct vEBStats
+{
+    // Bytes reserved by the arena (which copies of a tree share) and bytes
+    // of the blocks the tree uses.
+    size_t arena_bytes, bytes;
+    // Clusters allocated and non-empty at each recursion level. Level 0 is
+    // the root itself (so both are always 0 there), level 1 holds the
+    // clusters of the root, level 2 those of its clusters and of its
+    // summary, and so on.
+    std::vector<size_t> allocated_clusters, non_empty_clusters;
+    // Average number of nodes visited by the recent calls to insert and
+    // successor (summaries included), i.e. their recursion depth.
+    double insert_depth, successor_depth;
+};
+
+#define VEB_STATS_BYTES(delta) \
+    this->used_bytes.fetch_add((size_t)(delta), std::memory_order_relaxed)
+#define VEB_STATS_CLUSTERS(counters, node, delta) \
+    this->counters[level(node) + 1].fetch_add((size_t)(delta), \
+                                              std::memory_order_relaxed)
+#define VEB_STATS_VISIT()   ++visits
+#define VEB_STATS_START()   visits = 0
+#define VEB_STATS_RECORD(window)   this->record(this->window)
+
+#else
+
+// Still statements, so that e.g. an if or else with only a hook is fine.
+#define VEB_STATS_BYTES(delta)                      ((void)0)
+#define VEB_STATS_CLUSTERS(counters, node, delta)   ((void)0)
+#define VEB_STATS_VISIT()                           ((void)0)
+#define VEB_STATS_START()                           ((void)0)
+#define VEB_STATS_RECORD(window)                    ((void)0)
+
+#endif
+
+
+class vEBArena
+{
+    // Memory for the nodes of a single tree. Blocks are carved out of large
+    // chunks; released blocks go to a free list for their size and are reused
+    // by later allocations of the same size. Everything is returned to the
+    // system at once by clear() (or when the arena is destroyed).
+
+    std::vector<char*> chunks;
+    // (block size, head of the free list) pairs. There are only a few
+    // distinct block sizes per tree (one per universe size that appears).
+    std::vector<std::pair<size_t, void*>> free_lists;
+    char *next;
+    size_t remaining, chunk_size, reserved;
+
+    void *&free_list(size_t);
+
+public:
+    vEBArena();
+    vEBArena(const vEBArena&) = delete;
+    ~vEBArena();
+
+    const vEBArena &operator=(const vEBArena&) = delete;
+
+    void *allocate(size_t);
+    void release(void*, size_t);
+    void clear();
+    void merge(vEBArena&);
+    // Bytes reserved from the system.
+    size_t memory() const;
+};
+
+
+// van Emde Boas tree over the keys [0, n) of the unsigned (or non-negative)
+// integer type K. Every key may carry a payload of type V (see BasicvEBMap).
+template<class K, class V = vEBNoValue>
+class BasicvEBTree
 {
-    int *min, *max;
-    vEBTree *summary;
-    std::vector<vEBTree*> children;
+    // Cluster sizes fit in half the bits of K: the largest node of a 64-bit
+    // universe has 2^32 clusters of 2^32 keys each. They are stored minus
+    // one so that 2^32 (or 2^16 for 32-bit keys) fits too.
+    typedef typename std::conditional<(sizeof(K) > 4), uint32_t,
+                                      uint16_t>::type Half;
+
+    enum NodeFlags
+    {
+        LEAF = 1,
+        HASHED = 2,
+        // Set in every node of a map except from summaries, whose keys are
+        // cluster indexes.
+        PAYLOADS = 4,
+        // The remaining bits hold the recursion level of the node (0 for
+        // the root).
+        LEVEL_SHIFT = 3
+    };
 
-    size_t block_size;
+    struct Node;
+    typedef std::unordered_map<K, Node*> ClusterMap;
 
-    void initialize_children(size_t);
-    void initialize_summary(size_t);
+    struct Node
+    {
+        // Stored inline; an empty node has min > max.
+        K min, max;
+        // Largest key of a cluster (block size - 1) and largest cluster
+        // index (number of clusters - 1). For leaves, max_child is the
+        // largest key of the universe.
+        Half max_child, max_cluster;
+        // log2(block size) for power-of-two splits, 0 otherwise.
+        unsigned char shift;
+        unsigned char flags;
+        V min_payload, max_payload;
+        // Dense nodes: summary and children are a single block of
+        // max_cluster + 2 contiguous nodes (summary first), or NULL when not
+        // allocated. Hashed nodes: the summary is a node of its own and the
+        // non-empty clusters are in a map. Leaves keep every key (min and
+        // max included) in bits instead, and their payloads (if any) in an
+        // array indexed by key while the leaf is not empty.
+        union
+        {
+            Node *summary;
+            V *payloads;
+        };
+        union
+        {
+            Node *children;
+            ClusterMap *clusters;
+            uint64_t bits;
+        };
+    };
+
+    static const bool has_payloads = !std::is_same<V, vEBNoValue>::value;
+    // Bytes before every block of nodes or payloads, which hold the number
+    // of references to it.
+    static const size_t BLOCK_HEADER = 16;
+
+    Node root;
+    // Shared with the copies of the tree, which share nodes with it too.
+    std::shared_ptr<vEBArena> arena;
+    int options;
+    K universe;
+
+#ifdef VEB_STATS
+    struct DepthWindow
+    {
+        // Nodes visited by the last VEB_STATS_WINDOW calls; the one at
+        // next % VEB_STATS_WINDOW is the oldest.
+        std::atomic<size_t> next;
+        std::atomic<uint16_t> depths[VEB_STATS_WINDOW];
+    };
+
+    std::atomic<size_t> used_bytes;
+    std::atomic<size_t> allocated_clusters[VEB_STATS_LEVELS],
+                        non_empty_clusters[VEB_STATS_LEVELS];
+    mutable DepthWindow insert_depths, successor_depths;
+    // Nodes visited by the current call of this thread.
+    static thread_local unsigned visits;
+
+    void reset_stats();
+    void record(DepthWindow&) const;
+    static double average(const DepthWindow&);
+#endif
 
-    size_t child_index(int) const;
-    int child_value(int) const;
+    friend class BasicvEBMap<K, V>;
 
-    void _insert(int);
-    void _remove(int);
-    bool _contains(int) const;
+    static bool is_empty(const Node&);
+    static bool is_leaf(const Node&);
+    static bool is_hashed(const Node&);
+    static bool has_payload(const Node&);
+    static unsigned level(const Node&);
+    static unsigned char child_flags(const Node&);
+    static bool has_clusters(const Node&);
+    static void clear(Node&);
+    static K num_children(const Node&);
+    static size_t clusters_size(const Node&);
+    static size_t payloads_size(const Node&);
+
+    bool is_lazy() const;
+    void build(Node&, K, unsigned char, vEBArena&);
+    void allocate_clusters(Node&, vEBArena&);
+    void release_clusters(Node&);
+    void release_cluster(Node&, K);
+    void destroy(Node&);
+
+    void *allocate_block(size_t, vEBArena&);
+    void release_block(void*, size_t);
+    static size_t &references(const void*);
+    static void share(const Node&);
+    void drop(Node&);
+    void unshare(Node&, vEBArena&);
+
+    static K child_index(const Node&, K);
+    static K child_value(const Node&, K);
+    static K block_size(const Node&);
+    static const Node *cluster(const Node&, K);
+    Node &ensure_cluster(Node&, K, vEBArena&);
+
+    void insert(K, const V&);
+    K successor(K, const V**) const;
+    void insert(Node&, K, const V&);
+    V remove(Node&, K);
+    void _insert(Node&, K, const V&);
+    V _remove(Node&, K);
+    static bool contains(const Node&, K);
+    static const V *find(const Node&, K);
+    static const V *payload(const Node&, K);
+    static K found(const Node&, K, K, const V**);
+    static K successor(const Node&, K, const V **payload = NULL);
+    static K predecessor(const Node&, K, const V **payload = NULL);
+
+    void leaf_insert(Node&, K, const V&);
+    V leaf_remove(Node&, K);
+    static K leaf_successor(const Node&, K);
+    static K leaf_predecessor(const Node&, K);
+    static uint64_t leaf_mask(K, K);
+
+    static bool next_cluster(const Node&, K&);
+    static bool previous_cluster(const Node&, K&);
+    template<class F>
+    static bool scan(const Node&, K, K, K, F&);
+    template<class F>
+    static bool scan_reverse(const Node&, K, K, K, F&);
+
+    void load(Node&, K*, size_t, std::vector<K>*, vEBArena&);
+    void load_clusters(Node&, K*, size_t, std::vector<K>*, vEBArena&);
+    void load_root(std::vector<K>&, unsigned);
+
+    enum SetOperation
+    {
+        SET_UNION,
+        SET_INTERSECTION,
+        SET_DIFFERENCE
+    };
+
+    // The keys of one of the trees below some node in a set operation:
+    // those of node (which may be NULL) plus a few loose ones. Loose keys
+    // are the min and max of ancestors of node, which are not stored in
+    // node itself. They are sorted and relative to base.
+    struct MergeSide
+    {
+        const Node *node;
+        const K *loose;
+        size_t count;
+        K base;
+    };
+
+    static uint64_t combine(SetOperation, uint64_t, uint64_t);
+    static uint64_t leaf_bits(const MergeSide&);
+    static void add_loose(const MergeSide&, std::vector<K>&);
+    static bool next_index(const MergeSide&, const Node&, K, size_t&, K&);
+    static MergeSide child_side(const MergeSide&, const Node&, K, size_t);
+    static void merge_loose(SetOperation, const MergeSide&, const MergeSide&,
+                            K, std::vector<K>&);
+    static void merge(SetOperation, const MergeSide&, const MergeSide&, K,
+                      std::vector<K>&, std::vector<K>*);
+    BasicvEBTree set_operation(SetOperation, const BasicvEBTree&) const;
 
     void erase();
-    void copy_from(const vEBTree&);
+    void copy_from(const BasicvEBTree&);
 
 public:
-    vEBTree(int);
-    vEBTree(const vEBTree&);
-    ~vEBTree();
+    BasicvEBTree(K, int options = VEB_DEFAULT);
+    // Copies take constant time: both trees share their nodes until they are
+    // modified, and then each of them copies the blocks of clusters on the
+    // path it modifies. Trees sharing nodes can be read concurrently with
+    // each other, but writing, copying or destroying them has to be
+    // serialized.
+    BasicvEBTree(const BasicvEBTree&);
+    ~BasicvEBTree();
 
-    void insert(int);
-    void remove(int);
+    void insert(K);
+    void remove(K);
+    template<class InputIterator>
+    void assign_sorted(InputIterator, InputIterator, unsigned threads = 1);
 
-    int get_min() const;
-    int get_max() const;
+    K get_min() const;
+    K get_max() const;
     bool is_empty() const;
-    bool contains(int) const;
-    int successor(int) const;
-    int predecessor(int) const;
+    bool contains(K) const;
+    K successor(K) const;
+    K predecessor(K) const;
+
+    template<class F>
+    void for_each_in_range(K, K, F) const;
+
+    template<bool Reverse>
+    class Iterator;
+    typedef Iterator<false> iterator;
+    typedef Iterator<true> reverse_iterator;
 
-    const vEBTree &operator=(const vEBTree&);
+    iterator begin() const;
+    iterator end() const;
+    reverse_iterator rbegin() const;
+    reverse_iterator rend() const;
+
+    // Set operations with a tree over the same universe (and with the same
+    // VEB_POWER_OF_TWO option). Both trees are merged cluster by cluster, so
+    // clusters that are empty in one of them are skipped (intersection) or
+    // taken without looking at the other one, and leaves are combined a
+    // word at a time. The result has the options of this tree. Only for
+    // trees without payloads.
+    BasicvEBTree set_union(const BasicvEBTree&) const;
+    BasicvEBTree set_intersection(const BasicvEBTree&) const;
+    BasicvEBTree set_difference(const BasicvEBTree&) const;
+
+#ifdef VEB_STATS
+    // Takes O(VEB_STATS_WINDOW) time.
+    vEBStats stats() const;
+#endif
+
+    const BasicvEBTree &operator=(const BasicvEBTree&);
 };
 
+
+// Iterators over the keys of a tree in increasing (iterator) or decreasing
+// (reverse_iterator) order. Keys are fetched in batches with a single scan of
+// the tree, so consecutive keys usually cost O(1) each. Iterators are
+// invalidated by any modification of the tree.
+template<class K, class V>
+template<bool Reverse>
+class BasicvEBTree<K, V>::Iterator
+{
+    const BasicvEBTree *tree;
+    K keys[VEB_ITERATOR_BATCH];
+    size_t count, position;
+
+    void fetch(K from)
+    {
+        // Fetches the keys from the given one onwards (or backwards).
+
+        this->count = this->position = 0;
+        auto collect = [this](K key) {
+            this->keys[this->count++] = key;
+            return this->count < VEB_ITERATOR_BATCH;
+        };
+        if(Reverse)
+            scan_reverse(this->tree->root, 0, from, 0, collect);
+        else
+            scan(this->tree->root, from, std::numeric_limits<K>::max(), 0,
+                 collect);
+    };
+
+public:
+    typedef std::forward_iterator_tag iterator_category;
+    typedef K value_type;
+    typedef ptrdiff_t difference_type;
+    typedef const K *pointer;
+    typedef const K &reference;
+
+    // The end of any tree.
+    Iterator() : tree(NULL), count(0), position(0) {};
+
+    Iterator(const BasicvEBTree *tree) : tree(tree), count(0), position(0)
+    {
+        if(!tree->is_empty())
+            this->fetch(Reverse ? tree->get_max() : tree->get_min());
+    };
+
+    const K &operator*() const
+    {
+        return this->keys[this->position];
+    };
+
+    Iterator &operator++()
+    {
+        if(++this->position == this->count)
+        {
+            K last = this->keys[this->count-1];
+            this->count = this->position = 0;
+            if(Reverse && last != this->tree->get_min())
+                this->fetch(last - 1);
+            else if(!Reverse && last != this->tree->get_max())
+                this->fetch(last + 1);
+        }
+        return *this;
+    };
+
+    Iterator operator++(int)
+    {
+        Iterator it = *this;
+        ++*this;
+        return it;
+    };
+
+    bool operator==(const Iterator &it) const
+    {
+        bool ended = this->position == this->count,
+             it_ended = it.position == it.count;
+        return ended || it_ended ? ended == it_ended : **this == *it;
+    };
+
+    bool operator!=(const Iterator &it) const
+    {
+        return !(*this == it);
+    };
+};
+
+
+template<class K, class V>
+BasicvEBTree<K, V>::BasicvEBTree(K n, int options)
+{
+    this->options = options;
+    this->universe = n;
+    this->arena = std::make_shared<vEBArena>();
+#ifdef VEB_STATS
+    this->reset_stats();
+#endif
+    this->build(this->root, n, has_payloads ? PAYLOADS : 0, *this->arena);
+}
+
+template<class K, class V>
+BasicvEBTree<K, V>::BasicvEBTree(const BasicvEBTree &t)
+{
+#ifdef VEB_STATS
+	this->reset_stats();
+#endif
+	this->copy_from(t);
+}
+
+template<class K, class V>
+BasicvEBTree<K, V>::~BasicvEBTree()
+{
+    this->erase();
+}
+
+template<class K, class V>
+void BasicvEBTree<K, V>::erase()
+{
+    // Nodes shared with other trees are left to them, and the rest go back
+    // to the arena. If no other tree uses the arena, it is cleared at once
+    // instead; only the cluster maps have to be deleted one by one.
+#ifdef VEB_STATS
+    this->reset_stats();
+#endif
+    if(this->arena.use_count() > 1)
+    {
+        this->drop(this->root);
+        this->arena = std::make_shared<vEBArena>();
+        return;
+    }
+
+    this->destroy(this->root);
+    this->arena->clear();
+}
+
+template<class K, class V>
+void BasicvEBTree<K, V>::destroy(Node &node)
+{
+    // Deletes the cluster maps below node. Clusters of dense nodes are
+    // smaller than them, so they are dense too and can be skipped.
+
+    if(!is_hashed(node) || node.summary == NULL)
+        return;
+
+    this->destroy(*node.summary);
+    typename ClusterMap::iterator it;
+    for(it = node.clusters->begin(); it != node.clusters->end(); ++it)
+        this->destroy(*it->second);
+    delete node.clusters;
+}
+
+template<class K, class V>
+void BasicvEBTree<K, V>::copy_from(const BasicvEBTree &t)
+{
+	this->options = t.options;
+	this->universe = t.universe;
+	this->root = t.root;
+	this->arena = t.arena;
+	share(this->root);
+#ifdef VEB_STATS
+	this->used_bytes.store(t.used_bytes.load());
+	for(size_t i = 0; i < VEB_STATS_LEVELS; ++i)
+	{
+		this->allocated_clusters[i].store(t.allocated_clusters[i].load());
+		this->non_empty_clusters[i].store(t.non_empty_clusters[i].load());
+	}
+#endif
+}
+
+// Copy on write. Blocks (the clusters of a node, the cluster nodes of hashed
+// nodes and the payloads of leaves) count how many nodes point to them. Any
+// block reachable from more than one tree has several references somewhere
+// on the path to it, and it is copied (with the references of the copy added
+// to the blocks below) before it is modified.
+
+template<class K, class V>
+void *BasicvEBTree<K, V>::allocate_block(size_t bytes, vEBArena &arena)
+{
+    char *block = (char*)arena.allocate(BLOCK_HEADER + bytes);
+    *(size_t*)block = 1;
+    VEB_STATS_BYTES(bytes);
+    return block + BLOCK_HEADER;
+}
+
+template<class K, class V>
+void BasicvEBTree<K, V>::release_block(void *block, size_t bytes)
+{
+    this->arena->release((char*)block - BLOCK_HEADER, BLOCK_HEADER + bytes);
+}
+
+template<class K, class V>
+size_t &BasicvEBTree<K, V>::references(const void *block)
+{
+    return *(size_t*)((char*)block - BLOCK_HEADER);
+}
+
+template<class K, class V>
+void BasicvEBTree<K, V>::share(const Node &node)
+{
+    // Adds a reference to the clusters (or payloads) of node.
+
+    if(is_leaf(node))
+    {
+        if(node.payloads != NULL)
+            ++references(node.payloads);
+    }
+    else if(node.summary != NULL)
+        ++references(node.summary);
+}
+
+template<class K, class V>
+void BasicvEBTree<K, V>::drop(Node &node)
+{
+    // Removes a reference to the clusters (or payloads) of node, releasing
+    // them if it was the last one.
+
+    if(is_leaf(node))
+    {
+        if(node.payloads != NULL && --references(node.payloads) == 0)
+            this->release_block(node.payloads, payloads_size(node));
+        return;
+    }
+
+    if(node.summary == NULL || --references(node.summary) > 0)
+        return;
+
+    if(is_hashed(node))
+    {
+        this->drop(*node.summary);
+        typename ClusterMap::iterator it;
+        for(it = node.clusters->begin(); it != node.clusters->end(); ++it)
+            if(--references(it->second) == 0)
+            {
+                this->drop(*it->second);
+                this->release_block(it->second, sizeof(Node));
+            }
+        delete node.clusters;
+    }
+    else
+        for(K i = 0; i <= num_children(node); ++i)
+            this->drop(node.summary[i]);
+    this->release_block(node.summary, clusters_size(node));
+}
+
+template<class K, class V>
+void BasicvEBTree<K, V>::unshare(Node &node, vEBArena &arena)
+{
+    // Gives node clusters of its own if they are shared, so that they can
+    // be modified. The cluster nodes of hashed nodes are copied separately
+    // by ensure_cluster.
+
+    if(node.summary == NULL || references(node.summary) == 1)
+        return;
+
+    // Copies replace the original blocks in the statistics.
+    VEB_STATS_BYTES(-clusters_size(node));
+    --references(node.summary);
+    if(is_hashed(node))
+    {
+        Node *summary = (Node*)this->allocate_block(sizeof(Node), arena);
+        *summary = *node.summary;
+        share(*summary);
+        node.summary = summary;
+        node.clusters = new ClusterMap(*node.clusters);
+
+        typename ClusterMap::iterator it;
+        for(it = node.clusters->begin(); it != node.clusters->end(); ++it)
+            ++references(it->second);
+        return;
+    }
+
+    Node *block = (Node*)this->allocate_block(clusters_size(node), arena);
+    std::copy(node.summary, node.summary + num_children(node) + 1, block);
+    for(K i = 0; i <= num_children(node); ++i)
+        share(block[i]);
+    node.summary = block;
+    node.children = block + 1;
+}
+
+template<class K, class V>
+bool BasicvEBTree<K, V>::is_empty(const Node &node)
+{
+    return node.min > node.max;
+}
+
+template<class K, class V>
+bool BasicvEBTree<K, V>::is_leaf(const Node &node)
+{
+    return node.flags & LEAF;
+}
+
+template<class K, class V>
+bool BasicvEBTree<K, V>::is_hashed(const Node &node)
+{
+    return node.flags & HASHED;
+}
+
+template<class K, class V>
+bool BasicvEBTree<K, V>::has_payload(const Node &node)
+{
+    return node.flags & PAYLOADS;
+}
+
+template<class K, class V>
+unsigned BasicvEBTree<K, V>::level(const Node &node)
+{
+    return node.flags >> LEVEL_SHIFT;
+}
+
+template<class K, class V>
+unsigned char BasicvEBTree<K, V>::child_flags(const Node &node)
+{
+    // Flags that the clusters of node inherit from it.
+    return (node.flags & PAYLOADS) | ((level(node) + 1) << LEVEL_SHIFT);
+}
+
+template<class K, class V>
+bool BasicvEBTree<K, V>::has_clusters(const Node &node)
+{
+    // True if some value is stored recursively (i.e., other than min and max).
+    return node.summary != NULL && !is_empty(*node.summary);
+}
+
+template<class K, class V>
+void BasicvEBTree<K, V>::clear(Node &node)
+{
+    node.min = std::numeric_limits<K>::max();
+    node.max = std::numeric_limits<K>::min();
+}
+
+template<class K, class V>
+K BasicvEBTree<K, V>::num_children(const Node &node)
+{
+    return (K)node.max_cluster + 1;
+}
+
+template<class K, class V>
+size_t BasicvEBTree<K, V>::clusters_size(const Node &node)
+{
+    // Bytes of the block holding the clusters (just the summary if hashed).
+    return is_hashed(node) ? sizeof(Node) :
+                             (num_children(node) + 1) * sizeof(Node);
+}
+
+template<class K, class V>
+size_t BasicvEBTree<K, V>::payloads_size(const Node &node)
+{
+    return ((K)node.max_child + 1) * sizeof(V);
+}
+
+template<class K, class V>
+K BasicvEBTree<K, V>::block_size(const Node &node)
+{
+    return (K)node.max_child + 1;
+}
+
+template<class K, class V>
+bool BasicvEBTree<K, V>::is_lazy() const
+{
+    return this->options & VEB_LAZY_CLUSTERS;
+}
+
+template<class K, class V>
+void BasicvEBTree<K, V>::build(Node &node, K n, unsigned char flags,
+                               vEBArena &arena)
+{
+    // flags holds PAYLOADS and the level of the node.
+
+    clear(node);
+    node.summary = NULL;
+    node.shift = 0;
+
+    if(n <= VEB_LEAF_UNIVERSE)
+    {
+        node.flags = flags | LEAF;
+        node.max_child = n - 1;
+        node.max_cluster = 0;
+        node.bits = 0;
+        return;
+    }
+
+    K block_size, num_children;
+    if(this->options & VEB_POWER_OF_TWO)
+    {
+        // The low half gets the extra bit when the number of bits is odd.
+        unsigned bits = 64 - __builtin_clzll((uint64_t)n - 1),
+                 high_bits = bits / 2;
+        node.shift = bits - high_bits;
+        block_size = (K)1 << node.shift;
+        num_children = (K)1 << high_bits;
+    }
+    else
+    {
+        // Enough clusters to cover the whole universe, even when n is not a
+        // perfect square (floor(sqrt(80)) * ceil(sqrt(80)) is only 72).
+        block_size = (K)ceil(sqrt((double)n));
+        num_children = (n - 1) / block_size + 1;
+    }
+
+    assert(block_size - 1 <= std::numeric_limits<Half>::max() &&
+           num_children - 1 <= std::numeric_limits<Half>::max());
+    node.max_child = block_size - 1;
+    node.max_cluster = num_children - 1;
+    node.flags = flags | (this->is_lazy() &&
+                          num_children > VEB_MAX_DENSE_CLUSTERS ? HASHED : 0);
+    node.children = NULL;
+
+    if(!this->is_lazy())
+        this->allocate_clusters(node, arena);
+}
+
+template<class K, class V>
+void BasicvEBTree<K, V>::allocate_clusters(Node &node, vEBArena &arena)
+{
+    // Dense nodes: the summary and the clusters are allocated together as a
+    // single block. Hashed nodes: only the summary, clusters are added to the
+    // map by ensure_cluster.
+
+    node.summary = (Node*)this->allocate_block(clusters_size(node), arena);
+    unsigned char flags = child_flags(node);
+    if(is_hashed(node))
+    {
+        node.clusters = new ClusterMap();
+        this->build(*node.summary, num_children(node), flags & ~PAYLOADS,
+                    arena);
+        return;
+    }
+
+    node.children = node.summary + 1;
+    VEB_STATS_CLUSTERS(allocated_clusters, node, num_children(node));
+
+    this->build(*node.summary, num_children(node), flags & ~PAYLOADS, arena);
+    for(K i = 0; i < num_children(node); ++i)
+        this->build(node.children[i], block_size(node), flags, arena);
+}
+
+template<class K, class V>
+void BasicvEBTree<K, V>::release_clusters(Node &node)
+{
+    // Called once every cluster is empty (lazy mode). At that point no node
+    // below them holds clusters of its own, so this is all that is left.
+
+    if(is_hashed(node))
+        delete node.clusters;
+    else
+        VEB_STATS_CLUSTERS(allocated_clusters, node,
+                           -(size_t)num_children(node));
+    VEB_STATS_BYTES(-clusters_size(node));
+    this->release_block(node.summary, clusters_size(node));
+    node.summary = NULL;
+    node.children = NULL;
+}
+
+template<class K, class V>
+void BasicvEBTree<K, V>::release_cluster(Node &node, K index)
+{
+    // Removes an empty cluster from the map of a hashed node.
+
+    typename ClusterMap::iterator it = node.clusters->find(index);
+    VEB_STATS_CLUSTERS(allocated_clusters, node, -1);
+    VEB_STATS_BYTES(-sizeof(Node));
+    this->release_block(it->second, sizeof(Node));
+    node.clusters->erase(it);
+}
+
+template<class K, class V>
+K BasicvEBTree<K, V>::child_index(const Node &node, K value)
+{
+    return node.shift ? value >> node.shift : value / block_size(node);
+}
+
+template<class K, class V>
+K BasicvEBTree<K, V>::child_value(const Node &node, K value)
+{
+    return node.shift ? value & node.max_child : value % block_size(node);
+}
+
+template<class K, class V>
+const typename BasicvEBTree<K, V>::Node *BasicvEBTree<K, V>::cluster(
+    const Node &node, K index)
+{
+    // NULL if the cluster is not allocated.
+
+    if(node.summary == NULL)
+        return NULL;
+    if(!is_hashed(node))
+        return &node.children[index];
+
+    typename ClusterMap::const_iterator it = node.clusters->find(index);
+    return it == node.clusters->end() ? NULL : it->second;
+}
+
+template<class K, class V>
+typename BasicvEBTree<K, V>::Node &BasicvEBTree<K, V>::ensure_cluster(
+    Node &node, K index, vEBArena &arena)
+{
+    // Returns the given cluster, ready to be modified along with the
+    // summary: they are allocated if needed, or copied if they are shared
+    // with other trees.
+
+    if(node.summary == NULL)
+        this->allocate_clusters(node, arena);
+    else
+        this->unshare(node, arena);
+
+    if(!is_hashed(node))
+        return node.children[index];
+
+    Node *&child = (*node.clusters)[index];
+    if(child == NULL)
+    {
+        child = (Node*)this->allocate_block(sizeof(Node), arena);
+        this->build(*child, block_size(node), child_flags(node), arena);
+        VEB_STATS_CLUSTERS(allocated_clusters, node, 1);
+    }
+    else if(references(child) > 1)
+    {
+        VEB_STATS_BYTES(-sizeof(Node));
+        --references(child);
+        Node *copy = (Node*)this->allocate_block(sizeof(Node), arena);
+        *copy = *child;
+        share(*copy);
+        child = copy;
+    }
+    return *child;
+}
+
+template<class K, class V>
+void BasicvEBTree<K, V>::_insert(Node &node, K value, const V &payload)
+{
+    // Recursively insert the given value into the appropriate child.
+
+    K index = child_index(node, value);
+    Node &child = this->ensure_cluster(node, index, *this->arena);
+    if(is_empty(child))
+    {
+        VEB_STATS_CLUSTERS(non_empty_clusters, node, 1);
+        this->insert(*node.summary, index, V());
+    }
+    this->insert(child, child_value(node, value), payload);
+}
+
+template<class K, class V>
+V BasicvEBTree<K, V>::_remove(Node &node, K value)
+{
+    // Recursively remove the given value from the appropriate child and
+    // return its payload.
+
+    K index = child_index(node, value);
+    Node &child = this->ensure_cluster(node, index, *this->arena);
+    V payload = this->remove(child, child_value(node, value));
+    if(is_empty(child))
+    {
+        VEB_STATS_CLUSTERS(non_empty_clusters, node, -1);
+        this->remove(*node.summary, index);
+        if(is_hashed(node))
+            this->release_cluster(node, index);
+        if(this->is_lazy() && is_empty(*node.summary))
+            this->release_clusters(node);
+    }
+    return payload;
+}
+
+template<class K, class V>
+void BasicvEBTree<K, V>::insert(K value)
+{
+    this->insert(value, V());
+}
+
+template<class K, class V>
+void BasicvEBTree<K, V>::insert(K value, const V &payload)
+{
+    VEB_STATS_START();
+    this->insert(this->root, value, payload);
+    VEB_STATS_RECORD(insert_depths);
+}
+
+template<class K, class V>
+void BasicvEBTree<K, V>::insert(Node &node, K value, const V &payload)
+{
+    VEB_STATS_VISIT();
+
+    if(is_leaf(node))
+    {
+        this->leaf_insert(node, value, payload);
+        return;
+    }
+
+    // Case 1 (trivial): insert first value.
+    if(is_empty(node))
+    {
+        node.min = value;
+        node.max = value;
+        node.min_payload = node.max_payload = payload;
+        return;
+    }
+
+    // Keys already stored as min or max only get their payload replaced. Any
+    // other key already in the tree is found further down in the same way.
+    if(value == node.min || value == node.max)
+    {
+        if(value == node.min)
+            node.min_payload = payload;
+        if(value == node.max)
+            node.max_payload = payload;
+        return;
+    }
+
+    // Case 2: insert a new minimum.
+    if(value < node.min)
+    {
+        // Important: recursively insert the former minimum into
+        // the tree, only if it is different from the maximum.
+        if(node.min != node.max)
+            this->_insert(node, node.min, node.min_payload);
+        node.min = value;
+        node.min_payload = payload;
+        return;
+    }
+
+    // Case 3: insert a new maximum.
+    if(value > node.max)
+    {
+        if(node.max != node.min)
+            this->_insert(node, node.max, node.max_payload);
+        node.max = value;
+        node.max_payload = payload;
+        return;
+    }
+
+    // Case 4: insert any other value recursively.
+    this->_insert(node, value, payload);
+}
+
+template<class K, class V>
+void BasicvEBTree<K, V>::remove(K value)
+{
+    this->remove(this->root, value);
+}
+
+template<class K, class V>
+V BasicvEBTree<K, V>::remove(Node &node, K value)
+{
+    // Precondition: tree must not be empty.
+    // Also, value should be stored in the tree. Returns its payload.
+    assert(!is_empty(node));
+
+    if(is_leaf(node))
+        return this->leaf_remove(node, value);
+
+    // Trivial case: tree has only one element.
+    if(value == node.min && value == node.max)
+    {
+        V payload = node.min_payload;
+        clear(node);
+        return payload;
+    }
+
+    // Delete the minimum. For this, we have to find the successor.
+    // It is important not to call successor(value) in order to
+    // keep O(log log n) time complexity (doing that will instead
+    // increase this bound to O(log n)).
+    if(value == node.min)
+    {
+        K new_min;
+        V payload = node.min_payload;
+
+        // These cases are analogous to subcases of case 2 of
+        // the successor method.
+        if(!has_clusters(node))
+        {
+            new_min = node.max;
+            node.min_payload = node.max_payload;
+        }
+        else
+        {
+            new_min = (node.summary->min * block_size(node)) +
+                      cluster(node, node.summary->min)->min;
+            // It is important to erase this value from the tree,
+            // since it will be now stored separately.
+            node.min_payload = this->_remove(node, new_min);
+        }
+
+        // Finally, update minimum and return.
+        node.min = new_min;
+        return payload;
+    }
+
+    // Delete the maximum. Analogous to previous case (comments on
+    /// predecessor method might also help).
+    if(value == node.max)
+    {
+        K new_max;
+        V payload = node.max_payload;
+
+        if(!has_clusters(node))
+        {
+            new_max = node.min;
+            node.max_payload = node.min_payload;
+        }
+        else
+        {
+            new_max = (node.summary->max * block_size(node)) +
+                      cluster(node, node.summary->max)->max;
+            node.max_payload = this->_remove(node, new_max);
+        }
+
+        node.max = new_max;
+        return payload;
+    }
+
+    // Erase any other value recursively.
+    return this->_remove(node, value);
+}
+
+template<class K, class V>
+bool BasicvEBTree<K, V>::contains(K value) const
+{
+    return contains(this->root, value);
+}
+
+template<class K, class V>
+bool BasicvEBTree<K, V>::contains(const Node &node, K value)
+{
+    // Also covers empty nodes, since their min is greater than their max.
+    if(value < node.min || value > node.max)
+        return false;
+
+    if(value == node.min || value == node.max)
+        return true;
+
+    if(is_leaf(node))
+        return (node.bits >> value) & 1;
+
+    // Recursively check whether the given value is contained into
+    // the appropriate child.
+    const Node *child = cluster(node, child_index(node, value));
+    return child != NULL && contains(*child, child_value(node, value));
+}
+
+template<class K, class V>
+const V *BasicvEBTree<K, V>::find(const Node &node, K value)
+{
+    // Same as contains, but returns the payload of the value (or NULL if
+    // it is not in the tree).
+
+    if(value < node.min || value > node.max)
+        return NULL;
+
+    if(value == node.min || value == node.max)
+        return payload(node, value);
+
+    if(is_leaf(node))
+        return (node.bits >> value) & 1 ? &node.payloads[value] : NULL;
+
+    const Node *child = cluster(node, child_index(node, value));
+    return child == NULL ? NULL : find(*child, child_value(node, value));
+}
+
+template<class K, class V>
+const V *BasicvEBTree<K, V>::payload(const Node &node, K value)
+{
+    // Payload of a value stored in node itself: its min or max, or any key
+    // of a leaf.
+
+    if(is_leaf(node))
+        return &node.payloads[value];
+    return value == node.min ? &node.min_payload : &node.max_payload;
+}
+
+template<class K, class V>
+K BasicvEBTree<K, V>::found(const Node &node, K value, K offset,
+                            const V **payload)
+{
+    // Result of successor and predecessor: value is stored in node itself
+    // and offset is the first key of node. Its payload is only looked up if
+    // asked for.
+
+    if(payload != NULL)
+        *payload = BasicvEBTree::payload(node, value);
+    return offset + value;
+}
+
+template<class K, class V>
+bool BasicvEBTree<K, V>::is_empty() const
+{
+    return is_empty(this->root);
+}
+
+
+template<class K, class V>
+K BasicvEBTree<K, V>::successor(K value) const
+{
+    return this->successor(value, NULL);
+}
+
+template<class K, class V>
+K BasicvEBTree<K, V>::successor(K value, const V **payload) const
+{
+    VEB_STATS_START();
+    K result = successor(this->root, value, payload);
+    VEB_STATS_RECORD(successor_depths);
+    return result;
+}
+
+template<class K, class V>
+K BasicvEBTree<K, V>::successor(const Node &node, K value, const V **payload)
+{
+    // Precondition: tree must not be empty and the value has to
+    // be less than the maximum currently stored. If payload is not NULL,
+    // it is pointed to the payload of the result.
+    assert(!is_empty(node) && value < node.max);
+    VEB_STATS_VISIT();
+
+    // Case 1: the value is less than the minimum (trivial case).
+    if(value < node.min)
+        return found(node, node.min, 0, payload);
+
+    if(is_leaf(node))
+        return found(node, leaf_successor(node, value), 0, payload);
+
+    K index = child_index(node, value),
+      child_value = BasicvEBTree::child_value(node, value),
+      offset = value - child_value;
+
+    // Seek the successor of the minimum.
+    if(value == node.min)
+    {
+        // Case 2a: tree contains no other value except from min and max.
+        if(!has_clusters(node))
+            return found(node, node.max, 0, payload);
+        // Case 2b: tree contains additional values. Thus, the answer is
+        // the minimum value stored in the minimum block. We have to be
+        // careful and add the appropriate offset in order to give the
+        // correct answer.
+        else
+        {
+            const Node *block = cluster(node, node.summary->min);
+            return found(*block, block->min,
+                         node.summary->min * block_size(node), payload);
+        }
+    }
+
+    // Search the successor of any value != min.
+    // Case 3a: the successor exists in the same block.
+    if(!has_clusters(node))
+        return found(node, node.max, 0, payload);
+    const Node *child = cluster(node, index);
+    if(child != NULL && !is_empty(*child) && child_value < child->max)
+        return offset + successor(*child, child_value, payload);
+    // Case 3b: the successor appears in the next nonempty block.
+    else if(index < node.summary->max)
+    {
+        K successor_block = successor(*node.summary, index);
+        const Node *block = cluster(node, successor_block);
+        return found(*block, block->min, successor_block * block_size(node),
+                     payload);
+    }
+    // Case 3c: no nonempty blocks remaining. Return max.
+    else return found(node, node.max, 0, payload);
+}
+
+template<class K, class V>
+K BasicvEBTree<K, V>::predecessor(K value) const
+{
+    return predecessor(this->root, value);
+}
+
+template<class K, class V>
+K BasicvEBTree<K, V>::predecessor(const Node &node, K value, const V **payload)
+{
+    // See comments of previous method (they are analogous).
+
+    assert(!is_empty(node) && value > node.min);
+
+    if(value > node.max)
+        return found(node, node.max, 0, payload);
+
+    if(is_leaf(node))
+        return found(node, leaf_predecessor(node, value), 0, payload);
+
+    K index = child_index(node, value),
+      child_value = BasicvEBTree::child_value(node, value),
+      offset = value - child_value;
+
+    if(value == node.max)
+    {
+        if(!has_clusters(node))
+            return found(node, node.min, 0, payload);
+        else
+        {
+            const Node *block = cluster(node, node.summary->max);
+            return found(*block, block->max,
+                         node.summary->max * block_size(node), payload);
+        }
+    }
+
+    if(!has_clusters(node))
+        return found(node, node.min, 0, payload);
+    const Node *child = cluster(node, index);
+    if(child != NULL && !is_empty(*child) && child_value > child->min)
+        return offset + predecessor(*child, child_value, payload);
+    else if(index > node.summary->min)
+    {
+        K predecessor_block = predecessor(*node.summary, index);
+        const Node *block = cluster(node, predecessor_block);
+        return found(*block, block->max,
+                     predecessor_block * block_size(node), payload);
+    }
+    else return found(node, node.min, 0, payload);
+}
+
+// Leaves: every key is a bit of a single word, so all operations take
+// constant time (tzcnt/lzcnt when available). min and max are kept up to date
+// as in any other node. Leaves of maps also hold an array of payloads, which
+// is allocated when the first key is inserted and released with the last one.
+
+template<class K, class V>
+void BasicvEBTree<K, V>::leaf_insert(Node &node, K value, const V &payload)
+{
+    if(has_payload(node))
+    {
+        if(node.bits == 0)
+            node.payloads = (V*)this->allocate_block(payloads_size(node),
+                                                     *this->arena);
+        else if(references(node.payloads) > 1)
+        {
+            // Shared with other trees.
+            VEB_STATS_BYTES(-payloads_size(node));
+            V *payloads = (V*)this->allocate_block(payloads_size(node),
+                                                   *this->arena);
+            std::copy(node.payloads, node.payloads + (K)node.max_child + 1,
+                      payloads);
+            --references(node.payloads);
+            node.payloads = payloads;
+        }
+        node.payloads[value] = payload;
+    }
+
+    node.bits |= (uint64_t)1 << value;
+    node.min = std::min(node.min, value);
+    node.max = std::max(node.max, value);
+}
+
+template<class K, class V>
+V BasicvEBTree<K, V>::leaf_remove(Node &node, K value)
+{
+    V payload = has_payload(node) ? node.payloads[value] : V();
+
+    node.bits &= ~((uint64_t)1 << value);
+    if(node.bits == 0)
+    {
+        if(has_payload(node))
+        {
+            VEB_STATS_BYTES(-payloads_size(node));
+            this->drop(node);
+        }
+        node.payloads = NULL;
+        clear(node);
+    }
+    else
+    {
+        node.min = __builtin_ctzll(node.bits);
+        node.max = 63 - __builtin_clzll(node.bits);
+    }
+    return payload;
+}
+
+template<class K, class V>
+K BasicvEBTree<K, V>::leaf_successor(const Node &node, K value)
+{
+    // Keys above value. (2 << 63) - 1 wraps around to all ones as expected.
+    uint64_t above = node.bits & ~(((uint64_t)2 << value) - 1);
+    return __builtin_ctzll(above);
+}
+
+template<class K, class V>
+K BasicvEBTree<K, V>::leaf_predecessor(const Node &node, K value)
+{
+    uint64_t below = node.bits & (((uint64_t)1 << value) - 1);
+    return 63 - __builtin_clzll(below);
+}
+
+// Bulk loading. Keys are sorted, distinct and relative to the node; they are
+// handed down by rewriting them in place as keys of the cluster they fall in,
+// so every level takes a single pass over its keys and no summary is updated
+// more than once.
+
+template<class K, class V>
+template<class InputIterator>
+void BasicvEBTree<K, V>::assign_sorted(InputIterator begin, InputIterator end,
+                                       unsigned threads)
+{
+    // Replaces the contents of the tree with the keys in [begin, end), which
+    // must be sorted (repeated keys are allowed). With threads > 1, the
+    // top-level clusters are loaded in parallel.
+
+    std::vector<K> keys(begin, end);
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+    assert(std::is_sorted(keys.begin(), keys.end()));
+    assert(keys.empty() || keys.back() < this->universe);
+
+    if(!this->is_empty())
+    {
+        this->erase();
+        this->build(this->root, this->universe, has_payloads ? PAYLOADS : 0,
+                    *this->arena);
+    }
+    this->load_root(keys, threads);
+}
+
+template<class K, class V>
+void BasicvEBTree<K, V>::load(Node &node, K *keys, size_t count,
+                              std::vector<K> *indices, vEBArena &arena)
+{
+    // Fills the empty node with the given keys. indices holds one buffer per
+    // level below node, which are reused for the summary keys of every node
+    // at that level.
+
+    if(count == 0)
+        return;
+
+    node.min = keys[0];
+    node.max = keys[count-1];
+
+    if(is_leaf(node))
+    {
+        for(size_t i = 0; i < count; ++i)
+            node.bits |= (uint64_t)1 << keys[i];
+        return;
+    }
+
+    // Everything except from min and max goes to the clusters.
+    if(count > 2)
+    {
+        indices[0].clear();
+        this->load_clusters(node, keys + 1, count - 2, indices, arena);
+        this->load(*node.summary, indices[0].data(), indices[0].size(),
+                   indices + 1, arena);
+    }
+}
+
+template<class K, class V>
+void BasicvEBTree<K, V>::load_clusters(Node &node, K *keys, size_t count,
+                                       std::vector<K> *indices, vEBArena &arena)
+{
+    // Loads the clusters holding the given keys and puts their indexes (the
+    // keys of the summary) in indices[0].
+
+    for(size_t i = 0, j; i < count; i = j)
+    {
+        K index = child_index(node, keys[i]);
+        for(j = i; j < count && child_index(node, keys[j]) == index; ++j)
+            keys[j] = child_value(node, keys[j]);
+
+        this->load(this->ensure_cluster(node, index, arena), keys + i, j - i,
+                   indices + 1, arena);
+        indices[0].push_back(index);
+        VEB_STATS_CLUSTERS(non_empty_clusters, node, 1);
+    }
+}
+
+template<class K, class V>
+void BasicvEBTree<K, V>::load_root(std::vector<K> &keys, unsigned threads)
+{
+    // Universes lose about half of their bits from one level to the next,
+    // so this is more than enough levels.
+    const size_t levels = sizeof(K) * 8;
+
+    Node &root = this->root;
+    size_t count = keys.size();
+
+    if(threads <= 1 || is_leaf(root) || count <= 2)
+    {
+        std::vector<std::vector<K>> indices(levels);
+        this->load(root, keys.data(), count, indices.data(), *this->arena);
+        return;
+    }
+
+    root.min = keys[0];
+    root.max = keys[count-1];
+
+    // Find the top-level clusters and allocate them (so that the threads do
+    // not touch the root, or its cluster map if it is hashed).
+    std::vector<K> indices;
+    std::vector<size_t> starts;
+    std::vector<Node*> clusters;
+    for(size_t i = 1; i < count - 1; ++i)
+    {
+        K index = child_index(root, keys[i]);
+        if(indices.empty() || indices.back() != index)
+        {
+            indices.push_back(index);
+            starts.push_back(i);
+            clusters.push_back(&this->ensure_cluster(root, index,
+                                                     *this->arena));
+        }
+    }
+    starts.push_back(count - 1);
+    VEB_STATS_CLUSTERS(non_empty_clusters, root, indices.size());
+
+    // Each thread takes a range of consecutive clusters holding about the
+    // same number of keys, and allocates from an arena of its own.
+    std::vector<vEBArena> arenas(threads);
+    std::vector<std::thread> workers;
+    size_t first = 0;
+    for(unsigned t = 0; t < threads && first < clusters.size(); ++t)
+    {
+        size_t last = first, target = 1 + (count - 2) * (t + 1) / threads;
+        while(last < clusters.size() && (starts[last] < target ||
+                                         t == threads - 1))
+            ++last;
+
+        workers.push_back(std::thread([&, first, last, t]() {
+            std::vector<std::vector<K>> buffers(levels);
+            for(size_t c = first; c < last; ++c)
+            {
+                for(size_t i = starts[c]; i < starts[c+1]; ++i)
+                    keys[i] = child_value(root, keys[i]);
+                this->load(*clusters[c], &keys[starts[c]],
+                           starts[c+1] - starts[c], buffers.data(), arenas[t]);
+            }
+        }));
+        first = last;
+    }
+
+    std::vector<std::vector<K>> buffers(levels);
+    this->load(*root.summary, indices.data(), indices.size(), buffers.data(),
+               *this->arena);
+    for(size_t t = 0; t < workers.size(); ++t)
+        workers[t].join();
+    for(unsigned t = 0; t < threads; ++t)
+        this->arena->merge(arenas[t]);
+}
+
+// In-order traversal. Clusters are visited by walking the summary, and the
+// keys inside a leaf are extracted one bit at a time from its word.
+
+template<class K, class V>
+uint64_t BasicvEBTree<K, V>::leaf_mask(K lo, K hi)
+{
+    // Bits [lo, hi] of a word; lo must be at most 63.
+    hi = std::min(hi, (K)63);
+    return (~(uint64_t)0 << lo) & (((uint64_t)2 << hi) - 1);
+}
+
+template<class K, class V>
+bool BasicvEBTree<K, V>::next_cluster(const Node &node, K &index)
+{
+    // Moves index to the first non-empty cluster from index onwards. The
+    // node must have clusters. Returns false if there is none.
+
+    const Node *child = cluster(node, index);
+    if(child != NULL && !is_empty(*child))
+        return true;
+    if(index >= node.summary->max)
+        return false;
+    index = successor(*node.summary, index);
+    return true;
+}
+
+template<class K, class V>
+bool BasicvEBTree<K, V>::previous_cluster(const Node &node, K &index)
+{
+    const Node *child = cluster(node, index);
+    if(child != NULL && !is_empty(*child))
+        return true;
+    if(index <= node.summary->min)
+        return false;
+    index = predecessor(*node.summary, index);
+    return true;
+}
+
+template<class K, class V>
+template<class F>
+bool BasicvEBTree<K, V>::scan(const Node &node, K lo, K hi, K offset, F &fn)
+{
+    // Calls fn(offset + key) for every key of node in [lo, hi] in increasing
+    // order, until it returns false. Returns false if it was stopped.
+
+    if(is_empty(node) || hi < node.min || lo > node.max)
+        return true;
+
+    if(is_leaf(node))
+    {
+        uint64_t word = node.bits & leaf_mask(lo, hi);
+        for(; word != 0; word &= word - 1)
+            if(!fn(offset + __builtin_ctzll(word)))
+                return false;
+        return true;
+    }
+
+    if(lo <= node.min && !fn(offset + node.min))
+        return false;
+
+    if(has_clusters(node))
+    {
+        K from = std::max(lo, node.min), to = std::min(hi, node.max),
+          first = child_index(node, from), last = child_index(node, to),
+          index = first;
+
+        for(bool found = next_cluster(node, index); found && index <= last;
+            found = index < last && next_cluster(node, ++index))
+        {
+            K cluster_lo = index == first ? child_value(node, from) : 0,
+              cluster_hi = index == last ? child_value(node, to) :
+                                           (K)node.max_child;
+            if(!scan(*cluster(node, index), cluster_lo, cluster_hi,
+                     offset + index * block_size(node), fn))
+                return false;
+        }
+    }
+
+    if(node.max != node.min && node.max <= hi && !fn(offset + node.max))
+        return false;
+    return true;
+}
+
+template<class K, class V>
+template<class F>
+bool BasicvEBTree<K, V>::scan_reverse(const Node &node, K lo, K hi, K offset,
+                                       F &fn)
+{
+    // Same as scan, in decreasing order.
+
+    if(is_empty(node) || hi < node.min || lo > node.max)
+        return true;
+
+    if(is_leaf(node))
+    {
+        uint64_t word = node.bits & leaf_mask(lo, hi);
+        while(word != 0)
+        {
+            int bit = 63 - __builtin_clzll(word);
+            if(!fn(offset + bit))
+                return false;
+            word &= ~((uint64_t)1 << bit);
+        }
+        return true;
+    }
+
+    if(node.max <= hi && !fn(offset + node.max))
+        return false;
+
+    if(has_clusters(node))
+    {
+        K from = std::max(lo, node.min), to = std::min(hi, node.max),
+          first = child_index(node, from), last = child_index(node, to),
+          index = last;
+
+        for(bool found = previous_cluster(node, index); found && index >= first;
+            found = index > first && previous_cluster(node, --index))
+        {
+            K cluster_lo = index == first ? child_value(node, from) : 0,
+              cluster_hi = index == last ? child_value(node, to) :
+                                           (K)node.max_child;
+            if(!scan_reverse(*cluster(node, index), cluster_lo, cluster_hi,
+                             offset + index * block_size(node), fn))
+                return false;
+        }
+    }
+
+    if(node.min != node.max && lo <= node.min && !fn(offset + node.min))
+        return false;
+    return true;
+}
+
+template<class K, class V>
+template<class F>
+void BasicvEBTree<K, V>::for_each_in_range(K lo, K hi, F fn) const
+{
+    // Calls fn(key) for every key in [lo, hi], in increasing order.
+
+    auto visit = [&fn](K key) {
+        fn(key);
+        return true;
+    };
+    scan(this->root, lo, hi, 0, visit);
+}
+
+template<class K, class V>
+typename BasicvEBTree<K, V>::iterator BasicvEBTree<K, V>::begin() const
+{
+    return iterator(this);
+}
+
+template<class K, class V>
+typename BasicvEBTree<K, V>::iterator BasicvEBTree<K, V>::end() const
+{
+    return iterator();
+}
+
+template<class K, class V>
+typename BasicvEBTree<K, V>::reverse_iterator BasicvEBTree<K, V>::rbegin() const
+{
+    return reverse_iterator(this);
+}
+
+template<class K, class V>
+typename BasicvEBTree<K, V>::reverse_iterator BasicvEBTree<K, V>::rend() const
+{
+    return reverse_iterator();
+}
+
+// Set operations. Both trees are walked together, cluster by cluster, and the
+// keys of the result are collected in increasing order and bulk loaded into a
+// new tree. The min and max of a node are not stored in its clusters, so they
+// are handed down as loose keys until they reach a leaf (or a place where
+// neither tree has nodes). That way, the keys of both trees below a node are
+// always in the clusters of the same index.
+
+template<class K, class V>
+uint64_t BasicvEBTree<K, V>::combine(SetOperation op, uint64_t a, uint64_t b)
+{
+    if(op == SET_UNION)
+        return a | b;
+    if(op == SET_INTERSECTION)
+        return a & b;
+    return a & ~b;
+}
+
+template<class K, class V>
+uint64_t BasicvEBTree<K, V>::leaf_bits(const MergeSide &side)
+{
+    uint64_t bits = side.node == NULL ? 0 : side.node->bits;
+    for(size_t i = 0; i < side.count; ++i)
+        bits |= (uint64_t)1 << (side.loose[i] - side.base);
+    return bits;
+}
+
+template<class K, class V>
+void BasicvEBTree<K, V>::add_loose(const MergeSide &side, std::vector<K> &keys)
+{
+    // Appends the keys of side that are not in the clusters of its node
+    // (its loose keys, and the min and max of the node) to keys, relative
+    // to the node and sorted.
+
+    size_t start = keys.size();
+    for(size_t i = 0; i < side.count; ++i)
+        keys.push_back(side.loose[i] - side.base);
+
+    if(side.node == NULL || is_empty(*side.node))
+        return;
+    const Node &node = *side.node;
+    keys.insert(std::upper_bound(keys.begin() + start, keys.end(), node.min),
+                node.min);
+    if(node.max != node.min)
+        keys.insert(std::upper_bound(keys.begin() + start, keys.end(),
+                                     node.max), node.max);
+}
+
+template<class K, class V>
+bool BasicvEBTree<K, V>::next_index(const MergeSide &side, const Node &shape,
+                                    K from, size_t &i, K &index)
+{
+    // Moves index to the first cluster of shape from from onwards where side
+    // has some key: a non-empty cluster of its node or a loose key. i is
+    // moved to the first loose key in that cluster or later ones. Returns
+    // false if there is no such cluster.
+
+    while(i < side.count &&
+          child_index(shape, side.loose[i] - side.base) < from)
+        ++i;
+
+    bool found = i < side.count;
+    if(found)
+        index = child_index(shape, side.loose[i] - side.base);
+
+    K next = from;
+    if(side.node != NULL && has_clusters(*side.node) &&
+       from <= side.node->max_cluster && next_cluster(*side.node, next) &&
+       (!found || next < index))
+    {
+        index = next;
+        found = true;
+    }
+    return found;
+}
+
+template<class K, class V>
+typename BasicvEBTree<K, V>::MergeSide BasicvEBTree<K, V>::child_side(
+    const MergeSide &side, const Node &shape, K index, size_t i)
+{
+    // The keys of side in the given cluster. Its loose keys are looked for
+    // from i onwards.
+
+    while(i < side.count &&
+          child_index(shape, side.loose[i] - side.base) < index)
+        ++i;
+
+    MergeSide child;
+    child.node = side.node == NULL ? NULL : cluster(*side.node, index);
+    child.loose = side.loose + i;
+    child.count = 0;
+    while(i + child.count < side.count &&
+          child_index(shape, side.loose[i + child.count] - side.base) == index)
+        ++child.count;
+    child.base = side.base + index * block_size(shape);
+    return child;
+}
+
+template<class K, class V>
+void BasicvEBTree<K, V>::merge_loose(SetOperation op, const MergeSide &a,
+                                     const MergeSide &b, K offset,
+                                     std::vector<K> &keys)
+{
+    // Neither tree has nodes here, so only loose keys are left.
+
+    for(size_t i = 0, j = 0; i < a.count || j < b.count;)
+    {
+        K key_a = i < a.count ? a.loose[i] - a.base : 0,
+          key_b = j < b.count ? b.loose[j] - b.base : 0;
+        bool in_a = i < a.count && (j == b.count || key_a <= key_b),
+             in_b = j < b.count && (i == a.count || key_b <= key_a);
+        K key = in_a ? key_a : key_b;
+        if(combine(op, in_a, in_b))
+            keys.push_back(offset + key);
+        i += in_a;
+        j += in_b;
+    }
+}
+
+template<class K, class V>
+void BasicvEBTree<K, V>::merge(SetOperation op, const MergeSide &a,
+                               const MergeSide &b, K offset,
+                               std::vector<K> &keys, std::vector<K> *loose)
+{
+    // Appends offset + every key of the result below a and b, which are at
+    // the same place of their trees, to keys. loose holds one buffer per
+    // level below, for the loose keys of the clusters there.
+
+    const Node *shape = a.node != NULL ? a.node : b.node;
+    if(shape == NULL)
+    {
+        merge_loose(op, a, b, offset, keys);
+        return;
+    }
+
+    // Whole leaves at once.
+    if(is_leaf(*shape))
+    {
+        uint64_t word = combine(op, leaf_bits(a), leaf_bits(b));
+        for(; word != 0; word &= word - 1)
+            keys.push_back(offset + __builtin_ctzll(word));
+        return;
+    }
+
+    loose[0].clear();
+    add_loose(a, loose[0]);
+    size_t split = loose[0].size();
+    add_loose(b, loose[0]);
+    MergeSide left = {a.node, loose[0].data(), split, 0},
+              right = {b.node, loose[0].data() + split,
+                       loose[0].size() - split, 0};
+
+    // Only the clusters where the result may have keys are visited:
+    // intersections jump from one tree to the other until both have keys in
+    // the same cluster.
+    size_t i = 0, j = 0;
+    K from = 0, index, index_a, index_b;
+    for(;;)
+    {
+        bool found_a = next_index(left, *shape, from, i, index_a),
+             found_b = next_index(right, *shape, from, j, index_b);
+
+        if(op == SET_UNION && (found_a || found_b))
+            index = !found_b || (found_a && index_a < index_b) ? index_a :
+                                                                  index_b;
+        else if(op == SET_INTERSECTION && found_a && found_b)
+        {
+            if(index_a != index_b)
+            {
+                from = std::max(index_a, index_b);
+                continue;
+            }
+            index = index_a;
+        }
+        else if(op == SET_DIFFERENCE && found_a)
+            index = index_a;
+        else
+            break;
+
+        merge(op, child_side(left, *shape, index, i),
+              child_side(right, *shape, index, j),
+              offset + index * block_size(*shape), keys, loose + 1);
+        from = index + 1;
+    }
+}
+
+template<class K, class V>
+BasicvEBTree<K, V> BasicvEBTree<K, V>::set_operation(
+    SetOperation op, const BasicvEBTree &t) const
+{
+    static_assert(!has_payloads,
+                  "set operations are only defined for trees without payloads");
+    assert(this->universe == t.universe &&
+           (this->options & VEB_POWER_OF_TWO) ==
+           (t.options & VEB_POWER_OF_TWO));
+
+    std::vector<std::vector<K>> loose(sizeof(K) * 8);
+    std::vector<K> keys;
+    MergeSide a = {&this->root, NULL, 0, 0}, b = {&t.root, NULL, 0, 0};
+    merge(op, a, b, 0, keys, loose.data());
+
+    BasicvEBTree result(this->universe, this->options);
+    result.load_root(keys, 1);
+    return result;
+}
+
+template<class K, class V>
+BasicvEBTree<K, V> BasicvEBTree<K, V>::set_union(const BasicvEBTree &t) const
+{
+    return this->set_operation(SET_UNION, t);
+}
+
+template<class K, class V>
+BasicvEBTree<K, V> BasicvEBTree<K, V>::set_intersection(
+    const BasicvEBTree &t) const
+{
+    return this->set_operation(SET_INTERSECTION, t);
+}
+
+template<class K, class V>
+BasicvEBTree<K, V> BasicvEBTree<K, V>::set_difference(
+    const BasicvEBTree &t) const
+{
+    return this->set_operation(SET_DIFFERENCE, t);
+}
+
+#ifdef VEB_STATS
+
+template<class K, class V>
+thread_local unsigned BasicvEBTree<K, V>::visits = 0;
+
+template<class K, class V>
+void BasicvEBTree<K, V>::reset_stats()
+{
+    this->used_bytes = 0;
+    for(size_t i = 0; i < VEB_STATS_LEVELS; ++i)
+        this->allocated_clusters[i] = this->non_empty_clusters[i] = 0;
+    this->insert_depths.next = this->successor_depths.next = 0;
+}
+
+template<class K, class V>
+void BasicvEBTree<K, V>::record(DepthWindow &window) const
+{
+    // Readers may record concurrently. They could overwrite each other's
+    // sample now and then, which is cheaper than a locked increment.
+    size_t i = window.next.load(std::memory_order_relaxed);
+    window.next.store(i + 1, std::memory_order_relaxed);
+    window.depths[i % VEB_STATS_WINDOW].store(visits,
+                                              std::memory_order_relaxed);
+}
+
+template<class K, class V>
+double BasicvEBTree<K, V>::average(const DepthWindow &window)
+{
+    size_t count = std::min(window.next.load(std::memory_order_relaxed),
+                            (size_t)VEB_STATS_WINDOW),
+           total = 0;
+    for(size_t i = 0; i < count; ++i)
+        total += window.depths[i].load(std::memory_order_relaxed);
+    return count == 0 ? 0 : (double)total / count;
+}
+
+template<class K, class V>
+vEBStats BasicvEBTree<K, V>::stats() const
+{
+    vEBStats stats;
+    stats.arena_bytes = this->arena->memory();
+    stats.bytes = this->used_bytes.load();
+
+    // Up to the deepest level with clusters.
+    size_t levels = VEB_STATS_LEVELS;
+    while(levels > 0 && this->allocated_clusters[levels-1].load() == 0)
+        --levels;
+    for(size_t i = 0; i < levels; ++i)
+    {
+        stats.allocated_clusters.push_back(this->allocated_clusters[i]);
+        stats.non_empty_clusters.push_back(this->non_empty_clusters[i]);
+    }
+
+    stats.insert_depth = average(this->insert_depths);
+    stats.successor_depth = average(this->successor_depths);
+    return stats;
+}
+
+#endif
+
+template<class K, class V>
+K BasicvEBTree<K, V>::get_min() const
+{
+    assert(!this->is_empty());
+
+    return this->root.min;
+}
+
+template<class K, class V>
+K BasicvEBTree<K, V>::get_max() const
+{
+    assert(!this->is_empty());
+
+    return this->root.max;
+}
+
+template<class K, class V>
+const BasicvEBTree<K, V> &BasicvEBTree<K, V>::operator=(const BasicvEBTree& t)
+{
+	if(this != &t)
+	{
+		this->erase();
+		this->copy_from(t);
+	}
+
+	return *this;
+}
+
+// Type aliases: the original int-keyed tree and trees over the full range of
+// 32 and 64-bit unsigned keys (pass numeric_limits<K>::max() as universe).
+typedef BasicvEBTree<int> vEBTree;
+typedef BasicvEBTree<uint32_t> vEBTree32;
+typedef BasicvEBTree<uint64_t> vEBTree64;
+
+
+// Map from the keys [0, n) of K to payloads of type V. Payloads are stored in
+// the nodes of the tree next to their keys (inline with min and max, and in
+// arrays in the leaves), so no separate table is needed and successor and
+// predecessor find the payload of their result along the way. Payloads are
+// copied around as raw memory, so V has to be trivially copyable.
+//
+// Keys are unique; an integer priority queue with repeated priorities can use
+// priority * m + id as key (see vEBMapTest.dijkstra_test).
+template<class K, class V>
+class BasicvEBMap
+{
+    static_assert(std::is_trivially_copyable<V>::value,
+                  "vEB map payloads must be trivially copyable");
+
+    BasicvEBTree<K, V> tree;
+
+public:
+    typedef std::pair<K, V> value_type;
+
+    BasicvEBMap(K n, int options = VEB_DEFAULT) : tree(n, options) {};
+
+    // Inserts the key, or replaces its payload if it is already there.
+    void insert(K key, const V &payload)
+    {
+        this->tree.insert(key, payload);
+    };
+
+    // Removes the key, which must be in the map, and returns its payload.
+    V remove(K key)
+    {
+        return this->tree.remove(this->tree.root, key);
+    };
+
+    // Removes the smallest key and returns it with its payload.
+    value_type pop_min()
+    {
+        K key = this->tree.get_min();
+        return value_type(key, this->remove(key));
+    };
+
+    bool is_empty() const
+    {
+        return this->tree.is_empty();
+    };
+
+    bool contains(K key) const
+    {
+        return this->tree.contains(key);
+    };
+
+    // Payload of the key, or NULL if it is not in the map.
+    const V *find(K key) const
+    {
+        return BasicvEBTree<K, V>::find(this->tree.root, key);
+    };
+
+    value_type get_min() const
+    {
+        const typename BasicvEBTree<K, V>::Node &root = this->tree.root;
+        assert(!this->is_empty());
+        return value_type(root.min,
+                          *BasicvEBTree<K, V>::payload(root, root.min));
+    };
+
+    value_type get_max() const
+    {
+        const typename BasicvEBTree<K, V>::Node &root = this->tree.root;
+        assert(!this->is_empty());
+        return value_type(root.max,
+                          *BasicvEBTree<K, V>::payload(root, root.max));
+    };
+
+    // Same preconditions as in BasicvEBTree.
+    value_type successor(K key) const
+    {
+        const V *payload;
+        K result = this->tree.successor(key, &payload);
+        return value_type(result, *payload);
+    };
+
+    value_type predecessor(K key) const
+    {
+        const V *payload;
+        K result = BasicvEBTree<K, V>::predecessor(this->tree.root, key,
+                                                   &payload);
+        return value_type(result, *payload);
+    };
+};
+
+template<class V>
+using vEBMap = BasicvEBMap<int, V>;
+template<class V>
+using vEBMap32 = BasicvEBMap<uint32_t, V>;
+template<class V>
+using vEBMap64 = BasicvEBMap<uint64_t, V>;
+
 #endif
@@ -1,5 +1,21 @@
 #include "veb.h"
+#include "concurrent_veb.h"
 #include "gtest/gtest.h"
+#include <map>
+#include <queue>
+#include <set>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
 
 using namespace std;
 
@@ -205,3 +221,1097 @@ TEST_F(vEBTest, deletion_test_4)
 
 	EXPECT_TRUE(this->t->is_empty());
 }
+
+// Applies the same random insertions and removals to t and to a std::set
+// and checks that every query agrees. Keys are drawn from [0, range).
+static void check_against_set(vEBTree &t, int range, size_t operations,
+                              unsigned seed)
+{
+	// Start from whatever the tree already holds.
+	set<int> s;
+	if(!t.is_empty())
+	{
+		s.insert(t.get_min());
+		while(*s.rbegin() != t.get_max())
+			s.insert(t.successor(*s.rbegin()));
+	}
+
+	srand(seed);
+	for(size_t op = 0; op < operations; ++op)
+	{
+		int value = rand() % range;
+		if(s.count(value))
+		{
+			t.remove(value);
+			s.erase(value);
+		}
+		else
+		{
+			t.insert(value);
+			s.insert(value);
+		}
+
+		ASSERT_EQ(t.is_empty(), s.empty());
+		if(s.empty())
+			continue;
+		ASSERT_EQ(t.get_min(), *s.begin());
+		ASSERT_EQ(t.get_max(), *s.rbegin());
+
+		int probe = rand() % range;
+		ASSERT_EQ(t.contains(probe), s.count(probe) > 0);
+		set<int>::iterator next = s.upper_bound(probe);
+		if(next != s.end())
+		{
+			ASSERT_EQ(t.successor(probe), *next);
+		}
+		set<int>::iterator first = s.lower_bound(probe);
+		if(first != s.begin())
+		{
+			ASSERT_EQ(t.predecessor(probe), *--first);
+		}
+	}
+}
+
+TEST(vEBLazyTest, random_operations_test)
+{
+	vEBTree eager(1024), lazy(1024, VEB_LAZY_CLUSTERS);
+
+	check_against_set(eager, 1024, 5000, 1);
+	check_against_set(lazy, 1024, 5000, 1);
+
+	vEBTree copy(lazy);
+	check_against_set(copy, 1024, 2000, 2);
+}
+
+TEST(vEBLazyTest, large_universe_test)
+{
+	// An eager tree over this universe takes gigabytes.
+	vEBTree t(1 << 26, VEB_LAZY_CLUSTERS);
+
+	EXPECT_TRUE(t.is_empty());
+	t.insert(123456);
+	t.insert(50000000);
+	t.insert(7);
+	t.insert(60000000);
+	EXPECT_EQ(t.successor(7), 123456);
+	EXPECT_EQ(t.successor(123456), 50000000);
+	EXPECT_EQ(t.predecessor(60000000), 50000000);
+	t.remove(123456);
+	t.remove(50000000);
+	EXPECT_EQ(t.successor(7), 60000000);
+	EXPECT_FALSE(t.contains(123456));
+	check_against_set(t, 1 << 26, 2000, 3);
+}
+
+TEST(vEBArenaTest, reuse_test)
+{
+	vEBArena arena;
+
+	void *a = arena.allocate(100), *b = arena.allocate(100);
+	EXPECT_NE(a, b);
+	arena.release(a, 100);
+	// Released blocks are reused by allocations of the same size only.
+	EXPECT_NE(arena.allocate(200), a);
+	EXPECT_EQ(arena.allocate(100), a);
+	// Larger than any chunk so far.
+	EXPECT_TRUE(arena.allocate(1 << 22) != NULL);
+}
+
+TEST(vEBLeafTest, universe_sizes_test)
+{
+	// Single leaf, one level of leaves, and leaves of uneven sizes.
+	int universes[] = {2, 64, 65, 100, 4096, 5000};
+
+	for(size_t i = 0; i < sizeof(universes) / sizeof(int); ++i)
+	{
+		vEBTree eager(universes[i]), lazy(universes[i], VEB_LAZY_CLUSTERS);
+		check_against_set(eager, universes[i], 3000, i);
+		check_against_set(lazy, universes[i], 3000, i);
+	}
+}
+
+TEST(vEBLeafTest, word_boundaries_test)
+{
+	vEBTree t(64);
+
+	t.insert(0);
+	t.insert(63);
+	t.insert(31);
+	EXPECT_EQ(t.successor(0), 31);
+	EXPECT_EQ(t.successor(31), 63);
+	EXPECT_EQ(t.predecessor(63), 31);
+	EXPECT_EQ(t.predecessor(31), 0);
+	t.remove(63);
+	EXPECT_EQ(t.get_max(), 31);
+	t.remove(0);
+	EXPECT_EQ(t.get_min(), 31);
+	t.remove(31);
+	EXPECT_TRUE(t.is_empty());
+	EXPECT_FALSE(t.contains(31));
+}
+
+TEST(vEBPowerOfTwoTest, duplicate_insertion_test)
+{
+	vEBTree t(1000, VEB_POWER_OF_TWO);
+
+	for(int k = 0; k < 3; ++k)
+	{
+		t.insert(10);
+		t.insert(500);
+		t.insert(700);
+		t.insert(999);
+	}
+	t.remove(10);
+	t.remove(700);
+	EXPECT_EQ(t.get_min(), 500);
+	EXPECT_EQ(t.successor(500), 999);
+	EXPECT_FALSE(t.contains(10));
+	EXPECT_FALSE(t.contains(700));
+}
+
+TEST(vEBPowerOfTwoTest, random_operations_test)
+{
+	int universes[] = {77, 128, 1000, 5000, 1 << 20};
+
+	for(size_t i = 0; i < sizeof(universes) / sizeof(int); ++i)
+	{
+		vEBTree t(universes[i], VEB_POWER_OF_TWO),
+		        lazy(universes[i], VEB_POWER_OF_TWO | VEB_LAZY_CLUSTERS);
+		check_against_set(t, universes[i], 3000, i);
+		check_against_set(lazy, universes[i], 3000, i);
+	}
+}
+
+template<class F>
+static double seconds(F f)
+{
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	f();
+	return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+// Run with --gtest_also_run_disabled_tests.
+TEST(vEBPowerOfTwoTest, DISABLED_benchmark)
+{
+	const int n = 10000000;
+	const size_t keys = 1 << 20, queries = 1 << 22;
+	vector<int> values(keys), probes(queries);
+	srand(42);
+	for(size_t k = 0; k < keys; ++k)
+		values[k] = rand() % n;
+	for(size_t k = 0; k < queries; ++k)
+		probes[k] = rand() % n;
+
+	const char *names[] = {"sqrt split", "power of two"};
+	int options[] = {VEB_DEFAULT, VEB_POWER_OF_TWO};
+	long checksum[2] = {0, 0};
+
+	printf("n = %d, %zu keys, %zu queries (Mops/s)\n", n, keys, queries);
+	for(size_t i = 0; i < 2; ++i)
+	{
+		vEBTree t(n, options[i]);
+		double inserts = seconds([&]() {
+			for(size_t k = 0; k < keys; ++k)
+				t.insert(values[k]);
+		});
+		int min = t.get_min(), max = t.get_max();
+		double successors = seconds([&]() {
+			for(size_t k = 0; k < queries; ++k)
+				if(probes[k] < max)
+					checksum[i] += t.successor(probes[k]);
+		});
+		double predecessors = seconds([&]() {
+			for(size_t k = 0; k < queries; ++k)
+				if(probes[k] > min)
+					checksum[i] += t.predecessor(probes[k]);
+		});
+
+		printf("  %s: insert %.1f, successor %.1f, predecessor %.1f\n",
+		       names[i], keys / inserts / 1e6, queries / successors / 1e6,
+		       queries / predecessors / 1e6);
+	}
+	EXPECT_EQ(checksum[0], checksum[1]);
+}
+
+TEST(vEBKeyWidthTest, unsigned_32_test)
+{
+	vEBTree32 t(numeric_limits<uint32_t>::max(), VEB_LAZY_CLUSTERS);
+
+	t.insert(4000000000u);
+	t.insert(7);
+	t.insert(3000000000u);
+	EXPECT_EQ(t.get_min(), 7u);
+	EXPECT_EQ(t.get_max(), 4000000000u);
+	EXPECT_EQ(t.successor(7), 3000000000u);
+	EXPECT_EQ(t.predecessor(4000000000u), 3000000000u);
+	t.remove(3000000000u);
+	EXPECT_EQ(t.successor(7), 4000000000u);
+	EXPECT_FALSE(t.contains(3000000000u));
+}
+
+// Same as check_against_set for 64-bit keys spread over the whole universe.
+// Keys come in runs of nearby values so that lower levels get populated too.
+template<class Tree>
+static void check_64_against_set(Tree &t, size_t operations, unsigned seed)
+{
+	set<uint64_t> s;
+	mt19937_64 random(seed);
+	uint64_t base = 0;
+
+	for(size_t op = 0; op < operations; ++op)
+	{
+		if(op % 16 == 0)
+			base = random() - (1 << 20);
+		uint64_t value = base + random() % (1 << 20);
+		if(s.count(value))
+		{
+			t.remove(value);
+			s.erase(value);
+		}
+		else
+		{
+			t.insert(value);
+			s.insert(value);
+		}
+
+		ASSERT_EQ(t.get_min(), *s.begin());
+		ASSERT_EQ(t.get_max(), *s.rbegin());
+
+		uint64_t probe = op % 2 ? base + random() % (1 << 20) : random();
+		ASSERT_EQ(t.contains(probe), s.count(probe) > 0);
+		set<uint64_t>::iterator next = s.upper_bound(probe);
+		if(next != s.end())
+		{
+			ASSERT_EQ(t.successor(probe), *next);
+		}
+		set<uint64_t>::iterator first = s.lower_bound(probe);
+		if(first != s.begin())
+		{
+			ASSERT_EQ(t.predecessor(probe), *--first);
+		}
+	}
+}
+
+TEST(vEBKeyWidthTest, unsigned_64_test)
+{
+	const uint64_t n = numeric_limits<uint64_t>::max();
+	vEBTree64 t(n, VEB_LAZY_CLUSTERS),
+	          u(n, VEB_LAZY_CLUSTERS | VEB_POWER_OF_TWO);
+
+	check_64_against_set(t, 20000, 1);
+	check_64_against_set(u, 20000, 2);
+
+	// Hashed nodes are copied too. Both trees must hold the same keys.
+	vEBTree64 copy(t);
+	uint64_t key = t.get_min();
+	for(; key != t.get_max(); key = t.successor(key))
+		ASSERT_TRUE(copy.contains(key));
+	EXPECT_EQ(copy.get_max(), key);
+}
+
+// Checks that t holds exactly the (sorted) keys.
+template<class Tree, class K>
+static void check_keys(const Tree &t, const vector<K> &keys)
+{
+	ASSERT_EQ(t.is_empty(), keys.empty());
+	if(keys.empty())
+		return;
+	ASSERT_EQ(t.get_min(), keys[0]);
+	for(size_t i = 0; i + 1 < keys.size(); ++i)
+		ASSERT_EQ(t.successor(keys[i]), keys[i+1]);
+	ASSERT_EQ(t.get_max(), keys.back());
+}
+
+TEST(vEBBulkLoadTest, assign_sorted_test)
+{
+	const int n = 1000000;
+	int options[] = {VEB_DEFAULT, VEB_LAZY_CLUSTERS, VEB_POWER_OF_TWO,
+	                 VEB_LAZY_CLUSTERS | VEB_POWER_OF_TWO};
+	size_t sizes[] = {0, 1, 2, 3, 1000, 200000};
+
+	for(size_t o = 0; o < 4; ++o)
+		for(size_t k = 0; k < 6; ++k)
+			for(unsigned threads = 1; threads <= 4; threads += 3)
+			{
+				srand(k);
+				vector<int> keys(sizes[k]);
+				for(size_t i = 0; i < keys.size(); ++i)
+					keys[i] = rand() % n;
+				sort(keys.begin(), keys.end());
+
+				vEBTree t(n, options[o]);
+				t.insert(17);
+				t.assign_sorted(keys.begin(), keys.end(), threads);
+
+				keys.erase(unique(keys.begin(), keys.end()), keys.end());
+				check_keys(t, keys);
+				// Still usable afterwards.
+				check_against_set(t, n, 1000, k);
+			}
+}
+
+TEST(vEBBulkLoadTest, unsigned_64_test)
+{
+	mt19937_64 random(5);
+	vector<uint64_t> keys(100000);
+	for(size_t i = 0; i < keys.size(); ++i)
+		keys[i] = i % 2 ? keys[i-1] + random() % 1000 : random();
+	sort(keys.begin(), keys.end());
+	keys.erase(unique(keys.begin(), keys.end()), keys.end());
+
+	for(unsigned threads = 1; threads <= 4; threads += 3)
+	{
+		vEBTree64 t(numeric_limits<uint64_t>::max(), VEB_LAZY_CLUSTERS);
+		t.assign_sorted(keys.begin(), keys.end(), threads);
+		check_keys(t, keys);
+
+		// Clusters loaded by other threads can be released by this one.
+		for(size_t i = 0; i < keys.size(); i += 2)
+			t.remove(keys[i]);
+		EXPECT_FALSE(t.contains(keys[0]));
+		EXPECT_TRUE(t.contains(keys[1]));
+	}
+}
+
+TEST(vEBIterationTest, for_each_in_range_test)
+{
+	const int n = 100000;
+	int options[] = {VEB_DEFAULT, VEB_LAZY_CLUSTERS | VEB_POWER_OF_TWO};
+
+	for(size_t o = 0; o < 2; ++o)
+	{
+		vEBTree t(n, options[o]);
+		set<int> s;
+		srand(o);
+		for(int i = 0; i < 5000; ++i)
+		{
+			int key = rand() % 100 < 50 ? rand() % n : 40000 + rand() % 500;
+			t.insert(key);
+			s.insert(key);
+		}
+
+		for(int q = 0; q < 300; ++q)
+		{
+			int lo = rand() % n, hi = lo + rand() % (q % 3 ? 1000 : n);
+			vector<int> keys;
+			t.for_each_in_range(lo, hi, [&keys](int key) {
+				keys.push_back(key);
+			});
+			ASSERT_EQ(keys, vector<int>(s.lower_bound(lo), s.upper_bound(hi)));
+		}
+	}
+}
+
+TEST(vEBIterationTest, iterator_test)
+{
+	vEBTree empty(1000);
+	EXPECT_TRUE(empty.begin() == empty.end());
+	EXPECT_TRUE(empty.rbegin() == empty.rend());
+
+	const int n = 1 << 20;
+	vEBTree t(n, VEB_LAZY_CLUSTERS);
+	set<int> s;
+	srand(3);
+	for(int i = 0; i < 3000; ++i)
+	{
+		int key = rand() % n;
+		t.insert(key);
+		s.insert(key);
+	}
+
+	EXPECT_EQ(vector<int>(t.begin(), t.end()), vector<int>(s.begin(), s.end()));
+	EXPECT_EQ(vector<int>(t.rbegin(), t.rend()),
+	          vector<int>(s.rbegin(), s.rend()));
+	EXPECT_EQ(*t.begin(), t.get_min());
+	EXPECT_EQ(*t.rbegin(), t.get_max());
+}
+
+TEST(vEBIterationTest, unsigned_64_test)
+{
+	vEBTree64 t(numeric_limits<uint64_t>::max(), VEB_LAZY_CLUSTERS);
+	set<uint64_t> s;
+	mt19937_64 random(8);
+	for(int i = 0; i < 3000; ++i)
+	{
+		uint64_t key = i % 2 ? random() : random() % 100000;
+		t.insert(key);
+		s.insert(key);
+	}
+
+	EXPECT_EQ(vector<uint64_t>(t.begin(), t.end()),
+	          vector<uint64_t>(s.begin(), s.end()));
+	EXPECT_EQ(vector<uint64_t>(t.rbegin(), t.rend()),
+	          vector<uint64_t>(s.rbegin(), s.rend()));
+
+	vector<uint64_t> keys;
+	t.for_each_in_range(1000, 50000, [&keys](uint64_t key) {
+		keys.push_back(key);
+	});
+	EXPECT_EQ(keys, vector<uint64_t>(s.lower_bound(1000), s.upper_bound(50000)));
+}
+
+TEST(ConcurrentvEBTest, sequential_test)
+{
+	const int n = 100000;
+	ConcurrentvEBTree t(n, 100);
+	set<int> s;
+	int result;
+
+	EXPECT_TRUE(t.is_empty());
+	EXPECT_FALSE(t.successor(5, result));
+	srand(9);
+	for(int op = 0; op < 20000; ++op)
+	{
+		int key = rand() % n;
+		ASSERT_EQ(t.insert(key), s.insert(key).second);
+		if(op % 3 == 0)
+		{
+			key = rand() % n;
+			ASSERT_EQ(t.remove(key), s.erase(key) > 0);
+		}
+
+		int probe = rand() % n;
+		ASSERT_EQ(t.contains(probe), s.count(probe) > 0);
+		set<int>::iterator next = s.upper_bound(probe);
+		ASSERT_EQ(t.successor(probe, result), next != s.end());
+		if(next != s.end())
+		{
+			ASSERT_EQ(result, *next);
+		}
+		set<int>::iterator first = s.lower_bound(probe);
+		ASSERT_EQ(t.predecessor(probe, result), first != s.begin());
+		if(first != s.begin())
+		{
+			ASSERT_EQ(result, *--first);
+		}
+	}
+}
+
+TEST(ConcurrentvEBTest, concurrent_operations_test)
+{
+	// Multiples of 1000 stay in the tree all along, which bounds every
+	// successor and predecessor. Writer w toggles keys congruent to w + 1
+	// modulo 4 (so never those).
+	const int n = 1000000, writers = 3, readers = 3, operations = 20000;
+	ConcurrentvEBTree t(n, 64);
+	for(int key = 0; key < n; key += 1000)
+		t.insert(key);
+
+	atomic<bool> stop(false);
+	atomic<long> errors(0);
+	vector<thread> threads;
+	for(int w = 0; w < writers; ++w)
+		threads.push_back(thread([&t, w]() {
+			unsigned seed = w;
+			for(int op = 0; op < operations; ++op)
+			{
+				int key = rand_r(&seed) % (n / 4) * 4 + w + 1;
+				if(!t.insert(key))
+					t.remove(key);
+			}
+		}));
+	for(int r = 0; r < readers; ++r)
+		threads.push_back(thread([&, r]() {
+			unsigned seed = 100 + r;
+			int result;
+			while(!stop)
+			{
+				int key = 1 + rand_r(&seed) % (n - 2000);
+				if(!t.successor(key, result) || result <= key ||
+				   result > (key / 1000 + 1) * 1000)
+					errors++;
+				if(!t.predecessor(key, result) || result >= key ||
+				   result < (key - 1) / 1000 * 1000)
+					errors++;
+				if(!t.contains(key / 1000 * 1000))
+					errors++;
+			}
+		}));
+
+	for(int w = 0; w < writers; ++w)
+		threads[w].join();
+	stop = true;
+	for(int r = 0; r < readers; ++r)
+		threads[writers + r].join();
+	EXPECT_EQ(errors, 0);
+
+	// Replay the writers to find out what the tree should hold.
+	set<int> s;
+	for(int key = 0; key < n; key += 1000)
+		s.insert(key);
+	for(int w = 0; w < writers; ++w)
+	{
+		unsigned seed = w;
+		for(int op = 0; op < operations; ++op)
+		{
+			int key = rand_r(&seed) % (n / 4) * 4 + w + 1;
+			if(!s.insert(key).second)
+				s.erase(key);
+		}
+	}
+
+	vector<int> keys(1, 0);
+	int key;
+	while(t.successor(keys.back(), key))
+		keys.push_back(key);
+	EXPECT_EQ(keys, vector<int>(s.begin(), s.end()));
+}
+
+// Run with --gtest_also_run_disabled_tests.
+TEST(ConcurrentvEBTest, DISABLED_scaling_benchmark)
+{
+	// 90% successor queries, 10% updates, against a single tree guarded by a
+	// mutex.
+	const int n = 1 << 24;
+	const size_t operations = 1 << 20;
+	unsigned max_threads = max(4u, thread::hardware_concurrency());
+
+	printf("n = %d, %zu operations per thread (total Mops/s)\n", n,
+	       operations);
+	for(unsigned threads = 1; threads <= max_threads; threads *= 2)
+	{
+		ConcurrentvEBTree concurrent(n);
+		vEBTree locked(n, VEB_LAZY_CLUSTERS);
+		mutex lock;
+		for(int key = 0; key < n; key += 97)
+		{
+			concurrent.insert(key);
+			locked.insert(key);
+		}
+
+		auto run = [&](bool use_concurrent) {
+			vector<thread> workers;
+			for(unsigned w = 0; w < threads; ++w)
+				workers.push_back(thread([&, w]() {
+					unsigned seed = w;
+					long checksum = 0;
+					int result;
+					for(size_t op = 0; op < operations; ++op)
+					{
+						int key = rand_r(&seed) % (n - 97);
+						bool update = op % 10 == 0;
+						if(use_concurrent && update)
+						{
+							if(!concurrent.insert(key))
+								concurrent.remove(key);
+						}
+						else if(use_concurrent &&
+						        concurrent.successor(key, result))
+							checksum += result;
+						else if(!use_concurrent)
+						{
+							lock_guard<mutex> guard(lock);
+							if(update && !locked.contains(key))
+								locked.insert(key);
+							else if(update)
+								locked.remove(key);
+							else
+								checksum += locked.successor(key);
+						}
+					}
+					EXPECT_NE(checksum, -1);
+				}));
+			for(unsigned w = 0; w < threads; ++w)
+				workers[w].join();
+		};
+
+		double concurrent_time = seconds([&]() { run(true); }),
+		       locked_time = seconds([&]() { run(false); });
+		printf("  %u threads: concurrent %.1f, global mutex %.1f\n", threads,
+		       threads * operations / concurrent_time / 1e6,
+		       threads * operations / locked_time / 1e6);
+	}
+}
+
+template<class Map, class K>
+static void check_map(Map &m, K range, size_t operations, unsigned seed)
+{
+	// Random insertions (some of them replacing payloads) and removals,
+	// checked against std::map.
+	typedef pair<K, K> Entry;
+	map<K, K> expected;
+	mt19937_64 random(seed);
+
+	for(size_t op = 0; op < operations; ++op)
+	{
+		K key = random() % range;
+		if(random() % 3 == 0 && expected.count(key) > 0)
+		{
+			ASSERT_EQ(m.remove(key), expected[key]);
+			expected.erase(key);
+		}
+		else
+		{
+			K payload = random();
+			m.insert(key, payload);
+			expected[key] = payload;
+		}
+
+		ASSERT_EQ(m.is_empty(), expected.empty());
+		if(expected.empty())
+			continue;
+		ASSERT_EQ(m.get_min(), Entry(*expected.begin()));
+		ASSERT_EQ(m.get_max(), Entry(*expected.rbegin()));
+
+		K probe = random() % range;
+		typename map<K, K>::iterator it = expected.find(probe);
+		ASSERT_EQ(m.find(probe) == NULL, it == expected.end());
+		if(it != expected.end())
+		{
+			ASSERT_EQ(*m.find(probe), it->second);
+		}
+		if(probe < expected.rbegin()->first)
+		{
+			ASSERT_EQ(m.successor(probe), Entry(*expected.upper_bound(probe)));
+		}
+		if(probe > expected.begin()->first)
+		{
+			ASSERT_EQ(m.predecessor(probe),
+			          Entry(*--expected.lower_bound(probe)));
+		}
+	}
+}
+
+TEST(vEBMapTest, random_operations_test)
+{
+	for(int options = 0; options < 4; ++options)
+	{
+		vEBMap<int> m(5000, options);
+		check_map(m, 5000, 20000, options);
+	}
+
+	vEBMap64<uint64_t> m(numeric_limits<uint64_t>::max(), VEB_LAZY_CLUSTERS),
+	                   small(numeric_limits<uint64_t>::max(), VEB_LAZY_CLUSTERS);
+	check_map(m, numeric_limits<uint64_t>::max(), 20000, 7);
+	check_map(small, (uint64_t)1000, 5000, 8);
+}
+
+TEST(vEBMapTest, copy_test)
+{
+	vEBMap<int> m(1000, VEB_LAZY_CLUSTERS);
+	for(int key = 0; key < 1000; key += 3)
+		m.insert(key, -key);
+
+	vEBMap<int> copy(m);
+	m.insert(300, 0);
+	while(!m.is_empty())
+		m.pop_min();
+
+	for(int key = 0; key < 1000; ++key)
+	{
+		ASSERT_EQ(copy.contains(key), key % 3 == 0);
+		if(key % 3 == 0)
+		{
+			ASSERT_EQ(*copy.find(key), -key);
+		}
+	}
+}
+
+TEST(vEBMapTest, dijkstra_test)
+{
+	// Shortest paths with small integer weights. Vertices are queued by
+	// distance * n + vertex (so that keys are unique) with their parent in
+	// the shortest path tree as payload.
+	const int n = 2000, edges = 10000, max_weight = 10;
+	vector<vector<pair<int, int>>> graph(n);
+	srand(11);
+	for(int e = 0; e < edges; ++e)
+		graph[rand() % n].push_back(make_pair(rand() % n,
+		                                      1 + rand() % max_weight));
+
+	vector<int> distance(n, numeric_limits<int>::max()), parent(n, -1);
+	vEBMap<int> queue(max_weight * n * n, VEB_LAZY_CLUSTERS);
+	distance[0] = 0;
+	queue.insert(0, 0);
+	while(!queue.is_empty())
+	{
+		pair<int, int> top = queue.pop_min();
+		int u = top.first % n;
+		parent[u] = top.second;
+		for(size_t i = 0; i < graph[u].size(); ++i)
+		{
+			int v = graph[u][i].first, d = distance[u] + graph[u][i].second;
+			if(d >= distance[v])
+				continue;
+			if(distance[v] != numeric_limits<int>::max())
+				queue.remove(distance[v] * n + v);
+			distance[v] = d;
+			queue.insert(d * n + v, u);
+		}
+	}
+
+	// Same distances as with a binary heap.
+	vector<int> expected(n, numeric_limits<int>::max());
+	priority_queue<pair<int, int>, vector<pair<int, int>>,
+	               greater<pair<int, int>>> heap;
+	expected[0] = 0;
+	heap.push(make_pair(0, 0));
+	while(!heap.empty())
+	{
+		pair<int, int> top = heap.top();
+		heap.pop();
+		if(top.first > expected[top.second])
+			continue;
+		for(size_t i = 0; i < graph[top.second].size(); ++i)
+		{
+			int v = graph[top.second][i].first,
+			    d = top.first + graph[top.second][i].second;
+			if(d < expected[v])
+				heap.push(make_pair(expected[v] = d, v));
+		}
+	}
+	EXPECT_EQ(distance, expected);
+
+	// Every parent is the last step of a shortest path.
+	for(int v = 1; v < n; ++v)
+	{
+		if(parent[v] < 0)
+			continue;
+		bool found = false;
+		for(size_t i = 0; i < graph[parent[v]].size(); ++i)
+			found |= graph[parent[v]][i].first == v &&
+			         distance[parent[v]] + graph[parent[v]][i].second ==
+			         distance[v];
+		EXPECT_TRUE(found);
+	}
+}
+
+template<class Tree, class K>
+static void check_snapshots(Tree &t, K range, unsigned seed)
+{
+	// Takes snapshots while modifying both the tree and earlier snapshots,
+	// and checks that none of them sees the changes made to the others.
+	mt19937_64 random(seed);
+	vector<Tree*> trees(1, &t);
+	vector<set<K>> expected(1);
+	for(typename Tree::iterator it = t.begin(); it != t.end(); ++it)
+		expected[0].insert(*it);
+
+	for(int round = 0; round < 40; ++round)
+	{
+		size_t source = random() % trees.size();
+		trees.push_back(new Tree(*trees[source]));
+		expected.push_back(expected[source]);
+
+		for(int op = 0; op < 200; ++op)
+		{
+			size_t i = random() % trees.size();
+			K key = random() % range;
+			if(expected[i].count(key) > 0)
+			{
+				trees[i]->remove(key);
+				expected[i].erase(key);
+			}
+			else
+			{
+				trees[i]->insert(key);
+				expected[i].insert(key);
+			}
+		}
+
+		// Drop a snapshot now and then, and assign over another one.
+		if(round % 5 == 4)
+		{
+			size_t i = 1 + random() % (trees.size() - 1);
+			delete trees[i];
+			trees.erase(trees.begin() + i);
+			expected.erase(expected.begin() + i);
+
+			i = random() % trees.size();
+			*trees.back() = *trees[i];
+			expected.back() = expected[i];
+		}
+	}
+
+	for(size_t i = 0; i < trees.size(); ++i)
+	{
+		ASSERT_EQ(vector<K>(trees[i]->begin(), trees[i]->end()),
+		          vector<K>(expected[i].begin(), expected[i].end()));
+		if(i > 0)
+			delete trees[i];
+	}
+}
+
+TEST(vEBSnapshotTest, copy_on_write_test)
+{
+	for(int options = 0; options < 4; ++options)
+	{
+		vEBTree t(100000, options);
+		for(int key = 0; key < 100000; key += 7)
+			t.insert(key);
+		check_snapshots(t, 100000, options);
+	}
+
+	vEBTree64 t(numeric_limits<uint64_t>::max(), VEB_LAZY_CLUSTERS);
+	check_snapshots(t, numeric_limits<uint64_t>::max(), 5);
+	check_snapshots(t, (uint64_t)1 << 20, 6);
+}
+
+TEST(vEBSnapshotTest, map_test)
+{
+	vEBMap<int> m(10000, VEB_LAZY_CLUSTERS);
+	for(int key = 0; key < 10000; key += 2)
+		m.insert(key, key);
+
+	vEBMap<int> snapshot(m);
+	for(int key = 0; key < 10000; key += 3)
+		if(m.contains(key))
+			m.insert(key, -1);
+		else
+			m.insert(key, -2);
+	m.remove(0);
+
+	for(int key = 0; key < 10000; ++key)
+	{
+		ASSERT_EQ(snapshot.contains(key), key % 2 == 0);
+		if(key % 2 == 0)
+		{
+			ASSERT_EQ(*snapshot.find(key), key);
+		}
+		if(key > 0 && key % 3 == 0)
+		{
+			ASSERT_EQ(*m.find(key), key % 2 == 0 ? -1 : -2);
+		}
+	}
+}
+
+template<class T, class K>
+void check_set_operations(const T &a, const T &b)
+{
+	vector<K> keys_a(a.begin(), a.end()), keys_b(b.begin(), b.end()),
+	          expected;
+
+	set_union(keys_a.begin(), keys_a.end(), keys_b.begin(), keys_b.end(),
+	          back_inserter(expected));
+	T result = a.set_union(b);
+	ASSERT_EQ(vector<K>(result.begin(), result.end()), expected);
+
+	expected.clear();
+	set_intersection(keys_a.begin(), keys_a.end(), keys_b.begin(),
+	                 keys_b.end(), back_inserter(expected));
+	result = a.set_intersection(b);
+	ASSERT_EQ(vector<K>(result.begin(), result.end()), expected);
+
+	expected.clear();
+	set_difference(keys_a.begin(), keys_a.end(), keys_b.begin(), keys_b.end(),
+	               back_inserter(expected));
+	result = a.set_difference(b);
+	ASSERT_EQ(vector<K>(result.begin(), result.end()), expected);
+}
+
+TEST(vEBSetTest, random_test)
+{
+	const int sizes[] = {1, 2, 64, 77, 4096, 100000};
+	srand(5);
+
+	for(int options = 0; options < 4; ++options)
+		for(size_t s = 0; s < sizeof(sizes) / sizeof(int); ++s)
+			for(int round = 0; round < 10; ++round)
+			{
+				int n = sizes[s];
+				vEBTree a(n, options), b(n, options ^ VEB_LAZY_CLUSTERS);
+				// Dense or sparse ranges, so that some clusters are
+				// empty or full in either tree.
+				for(int i = 0; i < 4; ++i)
+				{
+					int from = rand() % n, to = from + rand() % (n / 4 + 1),
+					    step = 1 + rand() % 3 * (rand() % 20);
+					for(int key = from; key < min(to, n); key += step)
+						(i % 2 ? b : a).insert(key);
+				}
+				check_set_operations<vEBTree, int>(a, b);
+				check_set_operations<vEBTree, int>(b, a);
+				check_set_operations<vEBTree, int>(a, a);
+				check_set_operations<vEBTree, int>(a, vEBTree(n, options));
+			}
+
+	vEBTree64 a(numeric_limits<uint64_t>::max(), VEB_LAZY_CLUSTERS),
+	          b(numeric_limits<uint64_t>::max(), VEB_LAZY_CLUSTERS);
+	mt19937_64 random(7);
+	for(int i = 0; i < 20000; ++i)
+	{
+		uint64_t key = random() >> (i % 48);
+		if(i % 3 != 0)
+			a.insert(key);
+		if(i % 3 != 1)
+			b.insert(key);
+	}
+	check_set_operations<vEBTree64, uint64_t>(a, b);
+	check_set_operations<vEBTree64, uint64_t>(b, a);
+}
+
+// Run with --gtest_also_run_disabled_tests.
+TEST(vEBSetTest, DISABLED_benchmark)
+{
+	// Intersection of a dense and a sparse set, against looking up every key
+	// of the sparse one in the dense one and the other way round.
+	const int n = 1 << 24;
+	vEBTree dense(n, VEB_LAZY_CLUSTERS), sparse(n, VEB_LAZY_CLUSTERS);
+	for(int key = 0; key < n; key += 3)
+		dense.insert(key);
+	for(int key = 0; key < n; key += 1000)
+		sparse.insert(key);
+
+	auto time = [](const char *name, function<size_t()> f) {
+		auto start = chrono::steady_clock::now();
+		size_t count = f();
+		double ms = chrono::duration<double, milli>(
+		                chrono::steady_clock::now() - start).count();
+		printf("%-32s %8.2f ms (%zu keys)\n", name, ms, count);
+	};
+
+	time("set_intersection", [&]() {
+		vEBTree result = dense.set_intersection(sparse);
+		return (size_t)distance(result.begin(), result.end());
+	});
+	time("sparse keys looked up in dense", [&]() {
+		vEBTree result(n, VEB_LAZY_CLUSTERS);
+		for(int key : sparse)
+			if(dense.contains(key))
+				result.insert(key);
+		return (size_t)distance(result.begin(), result.end());
+	});
+	time("dense keys looked up in sparse", [&]() {
+		vEBTree result(n, VEB_LAZY_CLUSTERS);
+		for(int key : dense)
+			if(sparse.contains(key))
+				result.insert(key);
+		return (size_t)distance(result.begin(), result.end());
+	});
+	time("set_union", [&]() {
+		vEBTree result = dense.set_union(sparse);
+		return (size_t)distance(result.begin(), result.end());
+	});
+	time("set_difference", [&]() {
+		vEBTree result = dense.set_difference(sparse);
+		return (size_t)distance(result.begin(), result.end());
+	});
+}
+
+// Only built with -DVEB_STATS (see the Makefile).
+#ifdef VEB_STATS
+
+template<class K>
+void check_stats(const vEBStats &stats)
+{
+	ASSERT_LE(stats.bytes, stats.arena_bytes);
+	for(size_t i = 0; i < stats.allocated_clusters.size(); ++i)
+	{
+		ASSERT_LE(stats.non_empty_clusters[i], stats.allocated_clusters[i]);
+	}
+}
+
+TEST(vEBStatsTest, clusters_test)
+{
+	// 64 leaf clusters of 64 keys, all allocated upfront. The minimum and
+	// maximum are kept by the root, not by its clusters.
+	vEBTree t(4096, VEB_DEFAULT);
+	vEBStats stats = t.stats();
+	ASSERT_EQ(stats.allocated_clusters, vector<size_t>({0, 64}));
+	ASSERT_EQ(stats.non_empty_clusters, vector<size_t>({0, 0}));
+
+	t.insert(5);
+	t.insert(70);
+	t.insert(71);
+	t.insert(4000);
+	ASSERT_EQ(t.stats().non_empty_clusters, vector<size_t>({0, 1}));
+	t.insert(200);
+	ASSERT_EQ(t.stats().non_empty_clusters, vector<size_t>({0, 2}));
+	t.remove(70);
+	t.remove(71);
+	ASSERT_EQ(t.stats().non_empty_clusters, vector<size_t>({0, 1}));
+	ASSERT_EQ(t.stats().bytes, stats.bytes);
+
+	// Lazy trees free everything once they are empty again.
+	vEBTree64 u(numeric_limits<uint64_t>::max(), VEB_LAZY_CLUSTERS);
+	ASSERT_EQ(u.stats().bytes, 0u);
+	vector<uint64_t> keys;
+	mt19937_64 random(3);
+	for(int i = 0; i < 5000; ++i)
+	{
+		keys.push_back(random() >> (i % 40));
+		u.insert(keys.back());
+	}
+	stats = u.stats();
+	check_stats<uint64_t>(stats);
+	ASSERT_GT(stats.bytes, 0u);
+	// The clusters of the root are hashed, so only the non-empty ones are
+	// allocated.
+	ASSERT_EQ(stats.allocated_clusters[1], stats.non_empty_clusters[1]);
+
+	// A copy shares (and reports) the same memory until it is modified.
+	vEBTree64 copy(u);
+	vEBStats copy_stats = copy.stats();
+	ASSERT_EQ(copy_stats.bytes, stats.bytes);
+	ASSERT_EQ(copy_stats.arena_bytes, stats.arena_bytes);
+	ASSERT_EQ(copy_stats.allocated_clusters, stats.allocated_clusters);
+
+	for(size_t i = 0; i < keys.size(); ++i)
+		u.remove(keys[i]);
+	stats = u.stats();
+	ASSERT_EQ(stats.bytes, 0u);
+	ASSERT_TRUE(stats.allocated_clusters.empty());
+	ASSERT_EQ(copy.stats().allocated_clusters, copy_stats.allocated_clusters);
+}
+
+TEST(vEBStatsTest, bulk_load_test)
+{
+	// The shape of a tree only depends on its keys, so bulk loading (with
+	// one or more threads) has to give the same counts as inserting.
+	vector<uint64_t> keys;
+	for(uint64_t key = 0; key < 20000; ++key)
+		keys.push_back(key * key * 7919);
+
+	vEBTree64 inserted(numeric_limits<uint64_t>::max(), VEB_LAZY_CLUSTERS);
+	for(size_t i = 0; i < keys.size(); ++i)
+		inserted.insert(keys[i]);
+	vEBStats expected = inserted.stats();
+
+	for(unsigned threads = 1; threads <= 4; threads *= 4)
+	{
+		vEBTree64 t(numeric_limits<uint64_t>::max(), VEB_LAZY_CLUSTERS);
+		t.assign_sorted(keys.begin(), keys.end(), threads);
+		vEBStats stats = t.stats();
+		ASSERT_EQ(stats.allocated_clusters, expected.allocated_clusters);
+		ASSERT_EQ(stats.non_empty_clusters, expected.non_empty_clusters);
+		ASSERT_EQ(stats.bytes, expected.bytes);
+
+		for(size_t i = 0; i < keys.size(); i += 2)
+			t.remove(keys[i]);
+		stats = t.stats();
+		check_stats<uint64_t>(stats);
+		for(size_t i = 1; i < keys.size(); i += 2)
+			t.remove(keys[i]);
+		stats = t.stats();
+		ASSERT_TRUE(stats.allocated_clusters.empty());
+		ASSERT_EQ(stats.bytes, 0u);
+	}
+}
+
+TEST(vEBStatsTest, depth_test)
+{
+	vEBTree t(1 << 20, VEB_LAZY_CLUSTERS);
+	t.insert(0);
+	ASSERT_EQ(t.stats().insert_depth, 1);
+
+	for(int key = 1; key < (1 << 20); key += 17)
+		t.insert(key);
+	for(int key = 0; key < 1000; ++key)
+		t.successor(key);
+	vEBStats stats = t.stats();
+	size_t levels = stats.allocated_clusters.size();
+	ASSERT_GT(stats.insert_depth, 1);
+	ASSERT_LE(stats.insert_depth, 2.0 * levels);
+	ASSERT_GT(stats.successor_depth, 1);
+	ASSERT_LE(stats.successor_depth, 2.0 * levels);
+
+	// Only the root is left, so recent calls stop at it.
+	t = vEBTree(1 << 20, VEB_LAZY_CLUSTERS);
+	t.insert(0);
+	t.insert(1 << 19);
+	for(int i = 0; i < VEB_STATS_WINDOW; ++i)
+		t.successor(i);
+	ASSERT_EQ(t.stats().successor_depth, 1);
+}
+
+#endif